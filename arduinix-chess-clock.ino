@@ -2,6 +2,15 @@
 
 #include "clock-hardware.h"
 #include "clock-data-types.h"
+#include "clock-multiplex.h"
+#include "clock-animation.h"
+#include "clock-brightness.h"
+#include "clock-time-digits.h"
+#include "clock-timebase.h"
+#include "clock-move-log.h"
+#include "clock-power.h"
+#include "clock-stack.h"
+#include "clock-journal.h"
 
 /*
  * ===============================
@@ -10,27 +19,96 @@
  */
 const int JACKPOT_STEP_DURATION_MS = 50;
 const int JACKPOT_FULL_ROUNDS = 5;
-const int JACKPOT_DURATION_MS = JACKPOT_STEP_DURATION_MS * DIGITS_PER_TUBE * JACKPOT_FULL_ROUNDS;
 const unsigned long JACKPOT_MIN_ELAPSED_MS = 1000UL;
 const unsigned long JACKPOT_MIN_REMAINING_MS = 61000UL;
 const unsigned long MAX_DISPLAY_ELAPSED_MS = 359999900UL; // 99:59:59:900
 const int TIMEOUT_BLINK_DURATION_MS = 500;
 const int MENU_BLINK_DURATION_MS = 300;
+const uint16_t SCREEN_FRAME_NONE = 0xFFFF;
 const int BUTTON_DEBOUNCE_DELAY_MS = 20;
-const int STATUS_UPDATE_INTERVAL_MS = 1000;
-const int STATUS_UPDATE_MAX_CHARS = 30;
+const unsigned long BUTTON_DEBOUNCE_DELAY_US = BUTTON_DEBOUNCE_DELAY_MS * 1000UL;
+#if defined(CLOCK_BINARY_TELEMETRY)
+  const int STATUS_UPDATE_INTERVAL_MS = TELEMETRY_STATUS_INTERVAL_MS;
+#else
+  const int STATUS_UPDATE_INTERVAL_MS = 1000;
+#endif
 
-// ~120Hz / tube - tested on ИH-2 and ИH-12A tubes
-// Given Xms per-tube cycle, 1000ms / (Xms/tube * 6tubes) = Hz
-// 1.4ms ~= 120Hz
-// 2.8mz ~= 60Hz
+/*
+ * ===============================
+ *  Animations (see clock-animation.h)
+ * ===============================
+ */
+const byte ANIMATION_LEDS_BOTH = ANIMATION_LED_LEFT | ANIMATION_LED_RIGHT;
+const byte ANIMATION_LEDS_NONE = 0;
+
+#define SOURCE ANIMATION_TUBE_SOURCE
+
+// the selected option (see menuOptionTube()), blinking with both LEDs
+const AnimationFrame MENU_FRAMES[] PROGMEM = {
+  { { SOURCE, SOURCE, SOURCE, SOURCE, SOURCE, SOURCE }, ANIMATION_LEDS_BOTH, MENU_BLINK_DURATION_MS },
+  { { BLANK, BLANK, BLANK, BLANK, BLANK, BLANK }, ANIMATION_LEDS_NONE, MENU_BLINK_DURATION_MS }
+};
+const Animation MENU_ANIMATION PROGMEM = { MENU_FRAMES, ANIMATION_FRAME_COUNT(MENU_FRAMES), ANIMATION_LOOP };
+
+#if defined(CLOCK_BRIGHTNESS_CONTROL)
+  // the brightness in percent (see brightnessScreenTube())
+  const AnimationFrame BRIGHTNESS_FRAMES[] PROGMEM = {
+    { { BLANK, BLANK, SOURCE, SOURCE, SOURCE, BLANK }, ANIMATION_LEDS_BOTH, MENU_BLINK_DURATION_MS }
+  };
+  const Animation BRIGHTNESS_ANIMATION PROGMEM = { BRIGHTNESS_FRAMES, ANIMATION_FRAME_COUNT(BRIGHTNESS_FRAMES), ANIMATION_LOOP };
+
+  #if defined(AMBIENT_LIGHT_SENSOR_PIN)
+    // blinking, while it's following the ambient light sensor
+    const AnimationFrame BRIGHTNESS_AUTO_FRAMES[] PROGMEM = {
+      { { BLANK, BLANK, SOURCE, SOURCE, SOURCE, BLANK }, ANIMATION_LEDS_BOTH, MENU_BLINK_DURATION_MS },
+      { { BLANK, BLANK, BLANK, BLANK, BLANK, BLANK }, ANIMATION_LEDS_BOTH, MENU_BLINK_DURATION_MS }
+    };
+    const Animation BRIGHTNESS_AUTO_ANIMATION PROGMEM = { BRIGHTNESS_AUTO_FRAMES, ANIMATION_FRAME_COUNT(BRIGHTNESS_AUTO_FRAMES), ANIMATION_LOOP };
+  #endif
+#endif
 
-// const long MULTIPLEX_SINGLE_TUBE_LIT_DURATION_US = 750000L;
-// const long MULTIPLEX_SINGLE_TUBE_OFF_DURATION_US = 500000L;
-// const int MULTIPLEX_SINGLE_TUBE_LIT_DURATION_US = 2700;
-// const int MULTIPLEX_SINGLE_TUBE_OFF_DURATION_US =  100;
-const int MULTIPLEX_SINGLE_TUBE_LIT_DURATION_US = 1300;
-const int MULTIPLEX_SINGLE_TUBE_OFF_DURATION_US =  100;
+// zeros on the side that ran out, blinking with both LEDs, alternating with
+// the other side's LED
+const AnimationFrame TIMEOUT_LEFT_FRAMES[] PROGMEM = {
+  { { 0, 0, 0, 0, BLANK, BLANK }, ANIMATION_LEDS_BOTH, TIMEOUT_BLINK_DURATION_MS },
+  { { BLANK, BLANK, BLANK, BLANK, BLANK, BLANK }, ANIMATION_LED_RIGHT, TIMEOUT_BLINK_DURATION_MS }
+};
+const Animation TIMEOUT_LEFT_ANIMATION PROGMEM = { TIMEOUT_LEFT_FRAMES, ANIMATION_FRAME_COUNT(TIMEOUT_LEFT_FRAMES), ANIMATION_LOOP };
+
+const AnimationFrame TIMEOUT_RIGHT_FRAMES[] PROGMEM = {
+  { { BLANK, BLANK, 0, 0, 0, 0 }, ANIMATION_LEDS_BOTH, TIMEOUT_BLINK_DURATION_MS },
+  { { BLANK, BLANK, BLANK, BLANK, BLANK, BLANK }, ANIMATION_LED_LEFT, TIMEOUT_BLINK_DURATION_MS }
+};
+const Animation TIMEOUT_RIGHT_ANIMATION PROGMEM = { TIMEOUT_RIGHT_FRAMES, ANIMATION_FRAME_COUNT(TIMEOUT_RIGHT_FRAMES), ANIMATION_LOOP };
+
+// The once-a-minute scroll through every digit, on every tube at once, in
+// the order the cathodes are stacked in the tube, JACKPOT_FULL_ROUNDS times
+#if defined(CLOCK_CATHODE_BALANCING)
+  // each step's digits are picked as it's drawn, by cathodeCycleDigit()
+  const AnimationFrame JACKPOT_FRAMES[] PROGMEM = {
+    { { SOURCE, SOURCE, SOURCE, SOURCE, SOURCE, SOURCE }, ANIMATION_LEDS_KEEP, JACKPOT_STEP_DURATION_MS }
+  };
+  const Animation JACKPOT_ANIMATION PROGMEM = { JACKPOT_FRAMES, ANIMATION_FRAME_COUNT(JACKPOT_FRAMES), DIGITS_PER_TUBE * JACKPOT_FULL_ROUNDS };
+#else
+  constexpr AnimationFrame jackpotFrame(byte orderIndex) {
+    return {
+      {
+        TUBE_DIGIT_ORDER[orderIndex], TUBE_DIGIT_ORDER[orderIndex], TUBE_DIGIT_ORDER[orderIndex],
+        TUBE_DIGIT_ORDER[orderIndex], TUBE_DIGIT_ORDER[orderIndex], TUBE_DIGIT_ORDER[orderIndex]
+      },
+      ANIMATION_LEDS_KEEP,
+      JACKPOT_STEP_DURATION_MS
+    };
+  }
+
+  const AnimationFrame JACKPOT_FRAMES[DIGITS_PER_TUBE] PROGMEM = {
+    jackpotFrame(9), jackpotFrame(0), jackpotFrame(1), jackpotFrame(2), jackpotFrame(3),
+    jackpotFrame(4), jackpotFrame(5), jackpotFrame(6), jackpotFrame(7), jackpotFrame(8)
+  };
+  const Animation JACKPOT_ANIMATION PROGMEM = { JACKPOT_FRAMES, ANIMATION_FRAME_COUNT(JACKPOT_FRAMES), JACKPOT_FULL_ROUNDS };
+#endif
+
+#undef SOURCE
 
 /*
  * ===============================
@@ -48,33 +126,59 @@ byte utilityButtonVal = HIGH;
 unsigned long rightButtonLastDebounceMS = 0UL;
 unsigned long leftButtonLastDebounceMS = 0UL;
 unsigned long utilityButtonLastDebounceMS = 0UL;
-
-// nixie tube state 🚥🚥
-byte multiplexDisplayValues[TUBE_COUNT] = {BLANK, BLANK, BLANK, BLANK, BLANK, BLANK};
-byte lastDisplayRefreshTubeIndex = TUBE_COUNT;
-unsigned long lastDisplayRefreshTimestampUS = 0UL;
-bool multiplexIsLit = false;
+#if defined(BUTTON_CAPTURE_INTERRUPTS)
+  ButtonEdgeDebounce leftButtonEdges = { HIGH, HIGH, 0UL, 0UL };
+  ButtonEdgeDebounce rightButtonEdges = { HIGH, HIGH, 0UL, 0UL };
+  ButtonEdgeDebounce utilityButtonEdges = { HIGH, HIGH, 0UL, 0UL };
+#endif
 
 // chess clock state ♟⏲⏲♟
 ClockState currentClockState = CLOCK_IDLE;
 unsigned long lastStatusUpdateTimestampMS = 0UL;
-unsigned long lastJackpotTimestampMS = 0UL;
-unsigned long lastEventStepTimestampMS = 0UL;
 unsigned long turnStartTimestampMS = 0UL;
+unsigned long currentTurnLimitMS = 0UL;
+unsigned long currentTurnDelayMS = 0UL;
+bool currentTurnCountsUp = false;
+CountdownValues turnCountdown = { 0UL, 0UL }; // this loop's, for the status update
+PlayerBank leftPlayerBank = { 0UL, 0, 0 };
+PlayerBank rightPlayerBank = { 0UL, 0, 0 };
+#if defined(CLOCK_HIGH_RES_TIMING)
+  MonotonicTime turnStartTime = { 0ULL, 0UL, 0 };
+#endif
 bool leftPlayersTurn = false;
-bool blinkOn = false;
-bool jackpotOn = false;
-byte jackpotDigitOrderIndexValues[TUBE_COUNT] = {0, 0, 0, 0, 0, 0};
-char statusUpdate[STATUS_UPDATE_MAX_CHARS] = "";
-byte currentTurnTimerOption = 2;
+TimeDigits clockTimeDigits = { 0UL, {0, 0, 0, 0, 0, 0, 0, 0, 0}, false };
+bool clockTimeRendered = false;
+bool clockTimeRenderedLeftPlayersTurn = false;
+uint16_t screenFrameShownKey = SCREEN_FRAME_NONE;
+byte currentTurnTimerOption = 2; // < TURN_TIMER_OPTIONS_COUNT, or a TIME_CONTROL_OPTIONS entry after those
+
+// power management 💤
+#if defined(CLOCK_LOW_POWER)
+  unsigned long lastButtonPressTimestampMS = 0UL;
+  bool displayAsleep = false;
+#endif
 
 /*
  * ===============================
  *  Initial Setup (Power On)
  * ===============================
  */
+#if defined(CLOCK_BENCHMARK)
+  void runBenchmarks(); // clock-benchmark.h, included at the end of this file
+#endif
+inline void resumeJournaledGame(); // see Game Journal, below
+
 void setup() {
   setupHardware();
+  setupMultiplex();
+  setupBrightness();
+  setupInstrumentation();
+  setupStackReport();
+  resumeJournaledGame();
+
+  #if defined(CLOCK_BENCHMARK)
+    runBenchmarks();
+  #endif
 }
 
 /*
@@ -84,260 +188,733 @@ void setup() {
  */
 
 inline void setMultiplexDisplay(byte t0, byte t1, byte t2, byte t3, byte t4, byte t5) {
-  multiplexDisplayValues[0] = t0;
-  multiplexDisplayValues[1] = t1;
-  multiplexDisplayValues[2] = t2;
-  multiplexDisplayValues[3] = t3;
-  multiplexDisplayValues[4] = t4;
-  multiplexDisplayValues[5] = t5;
-}
-
-inline void loopMultiplex() {
-  if (multiplexIsLit && micros() - lastDisplayRefreshTimestampUS >= MULTIPLEX_SINGLE_TUBE_LIT_DURATION_US) {
-    blankTubes();
-    multiplexIsLit = false;
-    lastDisplayRefreshTimestampUS = micros();
-  } else if (!multiplexIsLit && micros() - lastDisplayRefreshTimestampUS >= MULTIPLEX_SINGLE_TUBE_OFF_DURATION_US) {
-    if (lastDisplayRefreshTubeIndex == 0) {
-      lastDisplayRefreshTubeIndex = TUBE_COUNT - 1;
-    } else {
-      lastDisplayRefreshTubeIndex--;
-    }
+  const byte frame[TUBE_COUNT] = {t0, t1, t2, t3, t4, t5};
+  setMultiplexFrame(frame);
+}
 
-    displayOnTube(lastDisplayRefreshTubeIndex, multiplexDisplayValues[lastDisplayRefreshTubeIndex]);
-    multiplexIsLit = true;
-    lastDisplayRefreshTimestampUS = micros();
+// The timeout, menu & idle screens are only redrawn when one of the inputs
+// they're drawn from changes: returns true if the frame for `key` (see
+// screenFrameKey()) is already the one on the display.
+inline bool screenFrameShown(uint16_t key) {
+  if (key == screenFrameShownKey) {
+    return true;
   }
+
+  screenFrameShownKey = key;
+  return false;
 }
 
-inline void handleJackpot(unsigned long loopNow) {
-  setMultiplexDisplay(
-    TUBE_DIGIT_ORDER[jackpotDigitOrderIndexValues[0]],
-    TUBE_DIGIT_ORDER[jackpotDigitOrderIndexValues[1]],
-    TUBE_DIGIT_ORDER[jackpotDigitOrderIndexValues[2]],
-    TUBE_DIGIT_ORDER[jackpotDigitOrderIndexValues[3]],
-    TUBE_DIGIT_ORDER[jackpotDigitOrderIndexValues[4]],
-    TUBE_DIGIT_ORDER[jackpotDigitOrderIndexValues[5]]
-  );
-  
-  if (loopNow - lastJackpotTimestampMS > JACKPOT_DURATION_MS) {
-    // jackpot over
-    jackpotOn = false;
-  } else if (loopNow - lastEventStepTimestampMS > JACKPOT_STEP_DURATION_MS) {
-    // advance to next jackpot step
-    for (byte i = 0; i < TUBE_COUNT; i++) {
-      if (jackpotDigitOrderIndexValues[i] == 9) {
-        jackpotDigitOrderIndexValues[i] = 0;
-      } else {
-        jackpotDigitOrderIndexValues[i]++;
-      }
-    }
+inline uint16_t screenFrameKey(byte option) {
+  return currentClockState | (leftPlayersTurn ? 1 << 3 : 0) | (option << 4);
+}
 
-    lastEventStepTimestampMS = loopNow;
-  }
+// force setMultiplexClockTime() to redraw, e.g. after another state or a
+// turn change has written to the display
+inline void invalidateClockTime() {
+  clockTimeRendered = false;
 }
 
 inline void setMultiplexClockTime(unsigned long elapsedMS, unsigned long remainingMS, unsigned long loopNow, bool displayElapsed) {
-  unsigned long totalMS = displayElapsed ? elapsedMS : remainingMS;
-  unsigned long totalSec = totalMS / 1000;
-  int hours = totalSec / 3600;
-  int hoursRemainder = totalSec % 3600;
-  int min = hoursRemainder / 60;
-  int sec = hoursRemainder % 60;
+  bool digitsChanged = updateTimeDigits(clockTimeDigits, displayElapsed ? elapsedMS : remainingMS);
+  const byte* d = clockTimeDigits.digits;
 
   // activate jackpot scroll on every whole minute (excluding when clock starts 
   // and times out), in an effort to preserve tubes / prevent uneven burn
-  if (sec == 0 && jackpotOn == false && elapsedMS > JACKPOT_MIN_ELAPSED_MS && (displayElapsed || remainingMS > JACKPOT_MIN_REMAINING_MS)) {
-    jackpotOn = true;
-    lastJackpotTimestampMS = loopNow;
-    
-    for (byte i = 0; i < TUBE_COUNT; i++) {
-      jackpotDigitOrderIndexValues[i] = 9;
-    }
+  if (d[TD_S10] == 0 && d[TD_S1] == 0 && !animationRunning() && elapsedMS > JACKPOT_MIN_ELAPSED_MS && (displayElapsed || remainingMS > JACKPOT_MIN_REMAINING_MS)) {
+    #if defined(CLOCK_CATHODE_BALANCING)
+      // favour each tube's least-used digits (see clock-cathode-wear.h)
+      rankCathodesByUsage();
+      playAnimation(&JACKPOT_ANIMATION, loopNow, cathodeCycleDigit);
+    #else
+      playAnimation(&JACKPOT_ANIMATION, loopNow);
+    #endif
+  }
+
+  // the jackpot has the display until it's over
+  if (animationRunning()) {
+    clockTimeRendered = false;
+    return;
+  }
+
+  // only rebuild the display when a shown digit (or the layout) changes
+  if (!digitsChanged && clockTimeRendered && clockTimeRenderedLeftPlayersTurn == leftPlayersTurn) {
+    return;
   }
 
-  if (jackpotOn) {
-    handleJackpot(loopNow);
-  } else if (hours > 0) {
-    setMultiplexDisplay(hours / 10, hours % 10, min / 10, min % 10, sec / 10, sec % 10);
-  } else if (min > 0) {
+  clockTimeRendered = true;
+  clockTimeRenderedLeftPlayersTurn = leftPlayersTurn;
+
+  if (d[TD_H10] || d[TD_H1]) {
+    setMultiplexDisplay(d[TD_H10], d[TD_H1], d[TD_M10], d[TD_M1], d[TD_S10], d[TD_S1]);
+  } else if (d[TD_M10] || d[TD_M1]) {
     if (leftPlayersTurn) {
-      setMultiplexDisplay(min / 10, min % 10, sec / 10, sec % 10, BLANK, BLANK);
+      setMultiplexDisplay(d[TD_M10], d[TD_M1], d[TD_S10], d[TD_S1], BLANK, BLANK);
     } else {
-      setMultiplexDisplay(BLANK, BLANK, min / 10, min % 10, sec / 10, sec % 10);
+      setMultiplexDisplay(BLANK, BLANK, d[TD_M10], d[TD_M1], d[TD_S10], d[TD_S1]);
     }
   } else {
-    int fractionalSec = (totalMS % 1000) / 10;
-
     if (leftPlayersTurn) {
-      setMultiplexDisplay(sec / 10, sec % 10, fractionalSec / 10, fractionalSec % 10, BLANK, BLANK);
+      setMultiplexDisplay(d[TD_S10], d[TD_S1], d[TD_CS10], d[TD_CS1], BLANK, BLANK);
     } else {
-      setMultiplexDisplay(BLANK, BLANK, sec / 10, sec % 10, fractionalSec / 10, fractionalSec % 10);
+      setMultiplexDisplay(BLANK, BLANK, d[TD_S10], d[TD_S1], d[TD_CS10], d[TD_CS1]);
+    }
+  }
+}
+
+inline bool timeControlSelected() {
+  return currentTurnTimerOption >= TURN_TIMER_OPTIONS_COUNT;
+}
+
+// a copy, out of flash
+inline TimeControlOption selectedTimeControl() {
+  TimeControlOption tc;
+  memcpy_P(&tc, &TIME_CONTROL_OPTIONS[currentTurnTimerOption - TURN_TIMER_OPTIONS_COUNT], sizeof(tc));
+  return tc;
+}
+
+// in flash
+inline const byte* selectedOptionDisplayValues() {
+  return timeControlSelected()
+    ? TIME_CONTROL_OPTIONS[currentTurnTimerOption - TURN_TIMER_OPTIONS_COUNT].displayValues
+    : TURN_TIMER_OPTIONS[currentTurnTimerOption].displayValues;
+}
+
+// a flash string, which stays put for as long as it's needed (e.g. in the move
+// log, or a queued notification)
+inline const char* selectedOptionLabel() {
+  return timeControlSelected()
+    ? TIME_CONTROL_OPTIONS[currentTurnTimerOption - TURN_TIMER_OPTIONS_COUNT].label
+    : TURN_TIMER_OPTIONS[currentTurnTimerOption].label;
+}
+
+inline PlayerBank& activePlayerBank() {
+  return leftPlayersTurn ? leftPlayerBank : rightPlayerBank;
+}
+
+inline void resetPlayerBanks() {
+  if (!timeControlSelected()) {
+    return;
+  }
+
+  leftPlayerBank = { (unsigned long)selectedTimeControl().stages[0].bankSeconds * 1000, 0, 0 };
+  rightPlayerBank = leftPlayerBank;
+}
+
+// pressUS is the micros() timestamp of the same moment as pressMS. The turn's
+// limit is worked out once here, so loopCountdown() stays as cheap with a
+// time control as it is with a plain turn limit.
+inline void startTurnTimer(unsigned long pressMS, unsigned long pressUS) {
+  turnStartTimestampMS = pressMS;
+
+  #if defined(CLOCK_HIGH_RES_TIMING)
+    turnStartTime = monotonicTimeAt(pressUS);
+  #endif
+
+  if (timeControlSelected()) {
+    const TimeControlOption& tc = selectedTimeControl();
+
+    currentTurnDelayMS = tc.incrementType == INCREMENT_BRONSTEIN ? tc.incrementSeconds * 1000UL : 0UL;
+    currentTurnLimitMS = activePlayerBank().bankMS + currentTurnDelayMS;
+    currentTurnCountsUp = false;
+  } else {
+    currentTurnDelayMS = 0UL;
+    currentTurnLimitMS = turnTimerLimitMS(currentTurnTimerOption);
+    currentTurnCountsUp = currentTurnLimitMS == 0UL;
+  }
+}
+
+// take the time used in the turn that's ending out of the active player's
+// bank, then apply the increment and move on to the next stage if it's due
+inline void chargePlayerBank(unsigned long pressMS, unsigned long pressUS) {
+  if (!timeControlSelected()) {
+    return;
+  }
+
+  const TimeControlOption& tc = selectedTimeControl();
+  PlayerBank& bank = activePlayerBank();
+
+  #if defined(CLOCK_HIGH_RES_TIMING)
+    MonotonicTime pressTime = monotonicTimeAt(pressUS);
+    unsigned long usedMS = monotonicElapsedMS(turnStartTime, pressTime);
+
+    bank.usedSubMsUS += monotonicElapsedSubMsUS(turnStartTime, pressTime);
+    if (bank.usedSubMsUS >= 1000) {
+      bank.usedSubMsUS -= 1000;
+      usedMS++;
     }
+  #else
+    unsigned long usedMS = pressMS - turnStartTimestampMS;
+  #endif
+
+  if (tc.incrementType == INCREMENT_BRONSTEIN) {
+    // time used within the delay is given back
+    usedMS = usedMS > currentTurnDelayMS ? usedMS - currentTurnDelayMS : 0UL;
+  }
+
+  bank.bankMS = usedMS < bank.bankMS ? bank.bankMS - usedMS : 0UL;
+
+  if (tc.incrementType == INCREMENT_FISCHER) {
+    bank.bankMS += tc.incrementSeconds * 1000UL;
+  }
+
+  bank.stageMoves++;
+  if (tc.stages[bank.stage].moves != 0 && bank.stageMoves >= tc.stages[bank.stage].moves && bank.stage + 1 < tc.stageCount) {
+    bank.stage++;
+    bank.stageMoves = 0;
+    bank.bankMS += tc.stages[bank.stage].bankSeconds * 1000UL;
+  }
+}
+
+// whole milliseconds into the current turn at the given moment
+inline unsigned long turnElapsedMS(unsigned long atMS, unsigned long atUS) {
+  #if defined(CLOCK_HIGH_RES_TIMING)
+    return monotonicElapsedMS(turnStartTime, monotonicTimeAt(atUS));
+  #else
+    return atMS - turnStartTimestampMS;
+  #endif
+}
+
+/*
+ * Game Journal (CLOCK_GAME_JOURNAL, see clock-journal.h)
+ */
+#if defined(CLOCK_GAME_JOURNAL)
+
+inline void journalGame() {
+  JournalEntry entry = {
+    currentClockState,
+    leftPlayersTurn,
+    currentTurnTimerOption,
+    journalTurnStartRTCSeconds,
+    leftPlayerBank,
+    rightPlayerBank
+  };
+  appendJournal(entry);
+}
+
+inline void journalTurnStarted() {
+  journalTurnStartRTCSeconds = journalRTCSeconds();
+  journalGame();
+}
+
+// moves the start of the current turn `agoMS` earlier
+inline void backdateTurnTimer(unsigned long agoMS) {
+  turnStartTimestampMS -= agoMS;
+
+  #if defined(CLOCK_HIGH_RES_TIMING)
+    turnStartTime.us -= agoMS * 1000ULL;
+    turnStartTime.ms -= agoMS;
+  #endif
+}
+
+// picks the game in the journal back up, if there was one in progress
+inline void resumeJournaledGame() {
+  JournalEntry entry;
+  if (!loadJournal(entry)) {
+    return;
+  }
+
+  if (entry.turnTimerOption < MENU_OPTIONS_COUNT) {
+    currentTurnTimerOption = entry.turnTimerOption;
+  }
+
+  if (entry.state != CLOCK_RUNNING) {
+    return;
+  }
+
+  leftPlayersTurn = entry.leftPlayersTurn;
+  leftPlayerBank = entry.leftBank;
+  rightPlayerBank = entry.rightBank;
+  resetMoveLog(leftPlayersTurn, selectedOptionLabel());
+  startTurnTimer(millis(), micros());
+
+  unsigned long nowRTCSeconds = journalRTCSeconds();
+  if (journalRTCKeptTime && entry.turnStartRTCSeconds != 0UL && nowRTCSeconds >= entry.turnStartRTCSeconds) {
+    // no further back than it takes to time out, so the milliseconds can't overflow
+    unsigned long offSeconds = nowRTCSeconds - entry.turnStartRTCSeconds;
+    unsigned long maxOffSeconds = (currentTurnCountsUp ? MAX_DISPLAY_ELAPSED_MS : currentTurnLimitMS) / 1000UL + 1UL;
+    backdateTurnTimer((offSeconds < maxOffSeconds ? offSeconds : maxOffSeconds) * 1000UL);
+    journalTurnStartRTCSeconds = entry.turnStartRTCSeconds;
+  } else {
+    journalTurnStartRTCSeconds = nowRTCSeconds;
+  }
+
+  currentClockState = CLOCK_RUNNING;
+  invalidateClockTime();
+  setButtonLEDs(leftPlayersTurn, !leftPlayersTurn);
+  Serial.println(F("Resumed the game in the journal"));
+}
+
+#else
+
+inline void journalGame() {}
+inline void journalTurnStarted() {}
+inline void resumeJournaledGame() {}
+
+#endif
+
+/*
+ * State Machine
+ *
+ * What each button press (and a turn running out) does in each state, as a
+ * table of [state][event] -> { next state, action }. Every event goes through
+ * dispatchClockEvent(), which moves to the next state and then runs the action,
+ * so actions see the state they lead into. To add a state, add its row here
+ * and its loop function to CLOCK_STATE_LOOPS (see loop()). The host
+ * simulation's --check-transitions walks the whole table.
+ */
+#if defined(CLOCK_BRIGHTNESS_CONTROL)
+  const ClockState MENU_UTILITY_NEXT_STATE = CLOCK_BRIGHTNESS;
+#else
+  const ClockState MENU_UTILITY_NEXT_STATE = CLOCK_IDLE;
+#endif
+
+constexpr ClockTransition CLOCK_TRANSITIONS[][CLOCK_EVENT_COUNT] PROGMEM = {
+  // CLOCK_IDLE
+  {
+    { CLOCK_RUNNING, ACTION_START_GAME },           // left button
+    { CLOCK_RUNNING, ACTION_START_GAME },           // right button
+    { CLOCK_MENU, ACTION_NONE },                    // utility button
+    { CLOCK_IDLE, ACTION_NONE }                     // turn expired
+  },
+  // CLOCK_RUNNING
+  {
+    { CLOCK_RUNNING, ACTION_END_TURN },
+    { CLOCK_RUNNING, ACTION_END_TURN },
+    { CLOCK_IDLE, ACTION_END_GAME },
+    { CLOCK_TIMEOUT, ACTION_EXPIRE_TURN }
+  },
+  // CLOCK_TIMEOUT
+  {
+    { CLOCK_IDLE, ACTION_NONE },
+    { CLOCK_IDLE, ACTION_NONE },
+    { CLOCK_IDLE, ACTION_NONE },
+    { CLOCK_TIMEOUT, ACTION_NONE }
+  },
+  // CLOCK_MENU
+  {
+    { CLOCK_MENU, ACTION_STEP_MENU },
+    { CLOCK_MENU, ACTION_STEP_MENU },
+    { MENU_UTILITY_NEXT_STATE, ACTION_NONE },
+    { CLOCK_MENU, ACTION_NONE }
+  },
+  // CLOCK_BRIGHTNESS
+  #if defined(CLOCK_BRIGHTNESS_CONTROL)
+  {
+    { CLOCK_BRIGHTNESS, ACTION_STEP_BRIGHTNESS },
+    { CLOCK_BRIGHTNESS, ACTION_STEP_BRIGHTNESS },
+    { CLOCK_IDLE, ACTION_NONE },
+    { CLOCK_BRIGHTNESS, ACTION_NONE }
+  }
+  #else
+  {
+    { CLOCK_IDLE, ACTION_NONE },
+    { CLOCK_IDLE, ACTION_NONE },
+    { CLOCK_IDLE, ACTION_NONE },
+    { CLOCK_IDLE, ACTION_NONE }
+  }
+  #endif
+};
+
+constexpr bool clockTransitionValid(const ClockTransition& t) {
+  return t.next < CLOCK_STATE_COUNT
+    && t.action < CLOCK_ACTION_COUNT
+    #if !defined(CLOCK_BRIGHTNESS_CONTROL)
+      && t.next != CLOCK_BRIGHTNESS
+      && t.action != ACTION_STEP_BRIGHTNESS
+    #endif
+    ;
+}
+
+constexpr bool clockTransitionsValid(byte i = 0) {
+  return i == CLOCK_STATE_COUNT * CLOCK_EVENT_COUNT
+    || (clockTransitionValid(CLOCK_TRANSITIONS[i / CLOCK_EVENT_COUNT][i % CLOCK_EVENT_COUNT]) && clockTransitionsValid(i + 1));
+}
+
+static_assert(sizeof(CLOCK_TRANSITIONS) / sizeof(CLOCK_TRANSITIONS[0]) == CLOCK_STATE_COUNT, "CLOCK_TRANSITIONS needs one row per ClockState");
+static_assert(clockTransitionsValid(), "CLOCK_TRANSITIONS leads to a state or action that doesn't exist in this build");
+
+inline void startGame(bool leftPlayerStarts, unsigned long pressMS, unsigned long pressUS) {
+  leftPlayersTurn = leftPlayerStarts;
+  resetPlayerBanks();
+  resetMoveLog(leftPlayersTurn, selectedOptionLabel());
+  startTurnTimer(pressMS, pressUS);
+  invalidateClockTime();
+
+  setButtonLEDs(leftPlayersTurn, !leftPlayersTurn);
+  notifyNewGame(leftPlayersTurn, selectedOptionLabel());
+  journalTurnStarted();
+}
+
+inline void endTurn(bool leftButton, unsigned long pressMS, unsigned long pressUS) {
+  // only the player whose turn it is can end it
+  if (leftButton != leftPlayersTurn) {
+    return;
+  }
+
+  logMove(turnElapsedMS(pressMS, pressUS));
+  chargePlayerBank(pressMS, pressUS);
+  leftPlayersTurn = !leftPlayersTurn;
+  startTurnTimer(pressMS, pressUS);
+  invalidateClockTime();
+
+  blankMultiplex();
+  setButtonLEDs(leftPlayersTurn, !leftPlayersTurn);
+  notifyPlayerTurn(leftPlayersTurn);
+  journalTurnStarted();
+}
+
+inline void expireTurn() {
+  blankMultiplex();
+  setButtonLEDs(leftPlayersTurn, !leftPlayersTurn);
+  notifyTimeout(leftPlayersTurn);
+  journalGame();
+}
+
+// left cycles down to smaller timer levels, right up to larger ones, looping
+// around at either end
+inline void stepMenu(bool leftButton) {
+  if (leftButton) {
+    currentTurnTimerOption = currentTurnTimerOption == 0 ? MENU_OPTIONS_COUNT - 1 : currentTurnTimerOption - 1;
+  } else {
+    currentTurnTimerOption = currentTurnTimerOption == MENU_OPTIONS_COUNT - 1 ? 0 : currentTurnTimerOption + 1;
   }
 }
 
-inline CountdownValues loopCountdown(unsigned long loopNow) {
-  unsigned long timeoutLimit = TURN_TIMER_OPTIONS[currentTurnTimerOption].turnLimitMS;
-  unsigned long elapsedMS = loopNow - turnStartTimestampMS;
-  unsigned long remainingMS = timeoutLimit - elapsedMS;
+inline void runClockAction(byte action, ClockEvent event, unsigned long atMS, unsigned long atUS) {
+  bool leftButton = event == EVENT_LEFT_BUTTON;
+
+  switch (action) {
+    case ACTION_START_GAME:
+      startGame(leftButton, atMS, atUS);
+      break;
+    case ACTION_END_TURN:
+      endTurn(leftButton, atMS, atUS);
+      break;
+    case ACTION_EXPIRE_TURN:
+      expireTurn();
+      break;
+    case ACTION_STEP_MENU:
+      stepMenu(leftButton);
+      break;
+    case ACTION_END_GAME:
+      journalGame();
+      break;
+    #if defined(CLOCK_BRIGHTNESS_CONTROL)
+      case ACTION_STEP_BRIGHTNESS:
+        if (leftButton) {
+          dimmerBrightnessSetting();
+        } else {
+          brighterBrightnessSetting();
+        }
+        break;
+    #endif
+  }
+}
+
+// atUS is the micros() timestamp of the same moment as atMS
+inline void dispatchClockEvent(ClockEvent event, unsigned long atMS, unsigned long atUS) {
+  const ClockTransition* transition = &CLOCK_TRANSITIONS[currentClockState][event];
+  byte action = pgm_read_byte(&transition->action);
+
+  ClockState next = (ClockState)pgm_read_byte(&transition->next);
+
+  // each state's screen starts its own animation, if it has one
+  if (next != currentClockState) {
+    stopAnimation();
+  }
+
+  currentClockState = next;
+  runClockAction(action, event, atMS, atUS);
+}
+
+inline bool turnEndPending(unsigned long loopNow, unsigned long timeoutLimit); // see loopCheckButtons()
+
+inline void loopCountdown(unsigned long loopNow) {
+  unsigned long timeoutLimit = currentTurnLimitMS;
+
+  // the clock time is drawn over whatever screen was showing
+  screenFrameShownKey = SCREEN_FRAME_NONE;
+
+  #if defined(CLOCK_HIGH_RES_TIMING)
+    unsigned long elapsedMS = monotonicElapsedMS(turnStartTime, loopTimebase());
+  #else
+    unsigned long elapsedMS = loopNow - turnStartTimestampMS;
+  #endif
+
+  // a Bronstein delay holds the remaining time still until it has passed
+  unsigned long chargedMS = elapsedMS > currentTurnDelayMS ? elapsedMS - currentTurnDelayMS : 0UL;
+  unsigned long remainingMS = timeoutLimit - currentTurnDelayMS - chargedMS;
 
   setButtonLEDs(leftPlayersTurn, !leftPlayersTurn);
 
-  if (timeoutLimit == 0UL) {
-    // special value 0: show elapsed time & never timeout
+  if (currentTurnCountsUp) {
+    // turn limit special value 0: show elapsed time & never timeout
     setMultiplexClockTime(elapsedMS, remainingMS, loopNow, true);
     remainingMS = 0UL;
 
     // reset elapsed to 0 when we can't display any higher numbers
     if (elapsedMS >= MAX_DISPLAY_ELAPSED_MS) {
-      turnStartTimestampMS = loopNow;
+      startTurnTimer(loopNow, micros());
     }
+  } else if (elapsedMS >= timeoutLimit && turnEndPending(loopNow, timeoutLimit)) {
+    // countdown expired, but the player pressed their button in time: hold at
+    // 0 until the press finishes debouncing and ends the turn
+    remainingMS = 0UL;
+    setMultiplexClockTime(chargedMS, remainingMS, loopNow, false);
   } else if (elapsedMS >= timeoutLimit) {
     // countdown expired: change state
     remainingMS = 0UL;
-    currentClockState = CLOCK_TIMEOUT;
-    
-    blankTubes();
-    setButtonLEDs(leftPlayersTurn, !leftPlayersTurn);
-    notifyTimeout(leftPlayersTurn);
+    dispatchClockEvent(EVENT_TURN_EXPIRED, loopNow, micros());
   } else {
     // countdown running: show remaining time
-    setMultiplexClockTime(elapsedMS, remainingMS, loopNow, false);
+    setMultiplexClockTime(chargedMS, remainingMS, loopNow, false);
   }
 
-  return { elapsedMS, remainingMS };
+  turnCountdown = { elapsedMS, remainingMS };
 }
 
 inline void loopTimeout(unsigned long loopNow) {
-  if (loopNow - lastEventStepTimestampMS > TIMEOUT_BLINK_DURATION_MS) {
-    lastEventStepTimestampMS = loopNow;
-    blinkOn = !blinkOn;
+  turnCountdown = { currentTurnLimitMS, 0UL };
+
+  playAnimation(leftPlayersTurn ? &TIMEOUT_LEFT_ANIMATION : &TIMEOUT_RIGHT_ANIMATION, loopNow);
+}
+
+inline byte menuOptionTube(byte tubeIndex, byte step) {
+  return pgm_read_byte(&selectedOptionDisplayValues()[tubeIndex]);
+}
+
+inline void loopMenu(unsigned long loopNow) {
+  playAnimation(&MENU_ANIMATION, loopNow, menuOptionTube);
+
+  if (!screenFrameShown(screenFrameKey(currentTurnTimerOption))) {
+    redrawAnimationFrame();
   }
+}
 
-  if (blinkOn) {
-    setButtonLEDs(true, true);
+#if defined(CLOCK_BRIGHTNESS_CONTROL)
 
-    if (leftPlayersTurn) {
-      setMultiplexDisplay(0, 0, 0, 0, BLANK, BLANK);
-    } else {
-      setMultiplexDisplay(BLANK, BLANK, 0, 0, 0, 0);
-    }
-  } else {
-    setButtonLEDs(!leftPlayersTurn, leftPlayersTurn);
-    setMultiplexDisplay(BLANK, BLANK, BLANK, BLANK, BLANK, BLANK);
+// the brightness in percent, on the middle tubes
+inline byte brightnessScreenTube(byte tubeIndex, byte step) {
+  switch (tubeIndex) {
+    case 2:
+      return brightnessPercent >= 100 ? brightnessPercent / 100 : BLANK;
+    case 3:
+      return brightnessPercent >= 10 ? brightnessPercent / 10 % 10 : BLANK;
+    default:
+      return brightnessPercent % 10;
   }
 }
 
-inline void loopMenu(unsigned long loopNow) {
-  if (loopNow - lastEventStepTimestampMS > MENU_BLINK_DURATION_MS) {
-    lastEventStepTimestampMS = loopNow;
-    blinkOn = !blinkOn;
-  }
-
-  if (blinkOn) {
-    setButtonLEDs(true, true);
-    setMultiplexDisplay(
-      TURN_TIMER_OPTIONS[currentTurnTimerOption].displayValues[0],
-      TURN_TIMER_OPTIONS[currentTurnTimerOption].displayValues[1],
-      TURN_TIMER_OPTIONS[currentTurnTimerOption].displayValues[2],
-      TURN_TIMER_OPTIONS[currentTurnTimerOption].displayValues[3],
-      TURN_TIMER_OPTIONS[currentTurnTimerOption].displayValues[4],
-      TURN_TIMER_OPTIONS[currentTurnTimerOption].displayValues[5]
-    );
-  } else {
+// blinking if it's following the ambient light sensor
+inline void loopBrightnessScreen(unsigned long loopNow) {
+  #if defined(AMBIENT_LIGHT_SENSOR_PIN)
+    const Animation* animation = brightnessSetting == BRIGHTNESS_AUTO ? &BRIGHTNESS_AUTO_ANIMATION : &BRIGHTNESS_ANIMATION;
+  #else
+    const Animation* animation = &BRIGHTNESS_ANIMATION;
+  #endif
+  playAnimation(animation, loopNow, brightnessScreenTube);
+
+  // (the sensor can change it at any time)
+  if (!screenFrameShown(screenFrameKey(brightnessPercent))) {
+    redrawAnimationFrame();
+  }
+}
+
+#endif
+
+inline void loopIdle(unsigned long loopNow) {
+  bool leftLED, rightLED;
+  idleButtonLEDs(loopNow, leftLED, rightLED);
+  setButtonLEDs(leftLED, rightLED);
+
+  if (screenFrameShown(screenFrameKey(0))) {
+    return;
+  }
+
+  setMultiplexDisplay(BLANK, BLANK, BLANK, BLANK, BLANK, BLANK);
+}
+
+#if defined(CLOCK_LOW_POWER)
+
+// Called first thing on every button press. Returns true if the press only
+// woke the display up, and shouldn't do anything else (e.g. end the turn).
+inline bool wakeOnButtonPress(unsigned long pressMS) {
+  lastButtonPressTimestampMS = pressMS;
+
+  if (!displayAsleep) {
+    return false;
+  }
+
+  displayAsleep = false;
+  invalidateClockTime();
+  return true;
+}
+
+inline bool longTurnRunning() {
+  return currentClockState == CLOCK_RUNNING && currentTurnLimitMS >= LONG_TURN_MIN_LIMIT_MS;
+}
+
+// Sleeps when there's nothing worth staying awake for: indefinitely when idle,
+// and between millis() ticks once a long turn has turned the display off.
+// Runs after the state handlers, so that it can blank what they've drawn.
+inline void loopPower(unsigned long loopNow) {
+  unsigned long sincePressMS = loopNow - lastButtonPressTimestampMS;
+
+  // (not with output still queued, which would wait until the next press)
+  if (currentClockState == CLOCK_IDLE && sincePressMS >= IDLE_SLEEP_DELAY_MS && !serialOutputPending() && !journalWritePending()) {
+    blankMultiplex();
+    sleepUntilButton();
+    return;
+  }
+
+  if (!longTurnRunning()) {
+    if (displayAsleep) {
+      // e.g. the turn timed out: show it
+      displayAsleep = false;
+      invalidateClockTime();
+    }
+    return;
+  }
+
+  if (!displayAsleep && sincePressMS >= LONG_TURN_DISPLAY_OFF_AFTER_MS) {
+    displayAsleep = true;
+    blankMultiplex();
+  }
+
+  if (displayAsleep) {
     setButtonLEDs(false, false);
     setMultiplexDisplay(BLANK, BLANK, BLANK, BLANK, BLANK, BLANK);
+    sleepUntilNextTick();
   }
 }
 
-inline void loopIdle() {
-  setButtonLEDs(false, false);
-  setMultiplexDisplay(BLANK, BLANK, BLANK, BLANK, BLANK, BLANK);
+#else
+
+inline bool wakeOnButtonPress(unsigned long pressMS) {
+  return false;
 }
 
+inline void loopPower(unsigned long loopNow) {}
+
+#endif
+
 inline void loopSendStatusUpdate(unsigned long loopNow, unsigned long elapsedMs, unsigned long remainingMs) {
-  if (loopNow - lastStatusUpdateTimestampMS > STATUS_UPDATE_INTERVAL_MS) {
-    snprintf(statusUpdate, STATUS_UPDATE_MAX_CHARS, "%d,%s,%d,%lu,%lu",
-      currentClockState,
-      TURN_TIMER_OPTIONS[currentTurnTimerOption].label,
-      leftPlayersTurn,
-      elapsedMs,
-      remainingMs
-    );
-    Serial.println(statusUpdate);
-    lastStatusUpdateTimestampMS = millis();
-  }
-}
-
-inline void handleRightButtonPress(unsigned long loopNow) {
-  if (currentClockState == CLOCK_RUNNING && !leftPlayersTurn) {
-    leftPlayersTurn = !leftPlayersTurn;
-    turnStartTimestampMS = loopNow;
-
-    blankTubes();
-    setButtonLEDs(leftPlayersTurn, !leftPlayersTurn);
-    notifyPlayerTurn(leftPlayersTurn);
-  } else if (currentClockState == CLOCK_MENU) {
-      // loop around if we're already on the largest option
-    if (currentTurnTimerOption == TURN_TIMER_OPTIONS_COUNT - 1) {
-      currentTurnTimerOption = 0;
-    } else {
-      // cycle upward to larger timer level
-      currentTurnTimerOption++;
-    }
-  } else if (currentClockState == CLOCK_IDLE) {
-    leftPlayersTurn = false;
-    turnStartTimestampMS = loopNow;
-    currentClockState = CLOCK_RUNNING;
-    
-    setButtonLEDs(leftPlayersTurn, !leftPlayersTurn);
-    notifyNewGame(false, TURN_TIMER_OPTIONS[currentTurnTimerOption].label);
-  } else if (currentClockState == CLOCK_TIMEOUT) {
-    currentClockState = CLOCK_IDLE;
-  }
-}
-
-inline void handleLeftButtonPress(unsigned long loopNow) {
-  if (currentClockState == CLOCK_RUNNING && leftPlayersTurn) {
-    leftPlayersTurn = !leftPlayersTurn;
-    turnStartTimestampMS = loopNow;
-    
-    blankTubes();
-    setButtonLEDs(leftPlayersTurn, !leftPlayersTurn);
-    notifyPlayerTurn(leftPlayersTurn);
-  } else if (currentClockState == CLOCK_MENU) {
-    if (currentTurnTimerOption == 0) {
-      // loop around if we're already on the smallest option
-      currentTurnTimerOption = TURN_TIMER_OPTIONS_COUNT - 1;
-    } else {
-      // cycle downward to smaller timer level
-      currentTurnTimerOption--;
-    }
-  } else if (currentClockState == CLOCK_IDLE) {
-    leftPlayersTurn = true;
-    turnStartTimestampMS = loopNow;
-    currentClockState = CLOCK_RUNNING;
+  if (loopNow - lastStatusUpdateTimestampMS >= STATUS_UPDATE_INTERVAL_MS) {
+    lastStatusUpdateTimestampMS = loopNow;
+
+    #if defined(CLOCK_BINARY_TELEMETRY)
+      byte payload[21];
+      payload[0] = currentClockState;
+      payload[1] = currentTurnTimerOption;
+      payload[2] = leftPlayersTurn ? TELEMETRY_FLAG_LEFT_PLAYERS_TURN : 0;
+      putTelemetryU32(&payload[3], elapsedMs);
+      putTelemetryU32(&payload[7], remainingMs);
+      putTelemetryU32(&payload[11], leftPlayerBank.bankMS);
+      putTelemetryU32(&payload[15], rightPlayerBank.bankMS);
+      putTelemetryU16(&payload[19], telemetryFramesSkipped);
+
+      sendTelemetryFrame(TELEMETRY_FRAME_STATUS, payload, sizeof(payload), true);
+    #else
+      // <state>,<option label>,<leftPlayersTurn>,<elapsed ms>,<remaining ms>
+      serialMessageBegin(SERIAL_STATUS);
+      serialPrintNumber(currentClockState);
+      serialPrint(",");
+      serialPrintFlash(selectedOptionLabel());
+      serialPrint(leftPlayersTurn ? ",1," : ",0,");
+      serialPrintNumber(elapsedMs);
+      serialPrint(",");
+      serialPrintNumber(remainingMs);
+      serialPrintln();
+      serialMessageEnd();
+    #endif
+  }
+}
+
+inline void handleButtonPress(ClockEvent button, unsigned long pressMS, unsigned long pressUS) {
+  if (wakeOnButtonPress(pressMS)) {
+    return;
+  }
+
+  dispatchClockEvent(button, pressMS, pressUS);
+}
+
+#if defined(BUTTON_CAPTURE_INTERRUPTS)
+
+// convert a micros() edge timestamp to the millis() timebase of loopNow
+inline unsigned long edgeTimestampMS(unsigned long timestampUS, unsigned long loopNow, unsigned long nowUS) {
+  return loopNow - (nowUS - timestampUS) / 1000;
+}
+
+inline void applyButtonEdge(ButtonEdgeDebounce& button, byte val, unsigned long timestampUS) {
+  if (val == button.rawVal) {
+    return;
+  }
+
+  // a press is timed from the first edge of its bounce burst
+  if (timestampUS - button.lastEdgeUS > BUTTON_DEBOUNCE_DELAY_US) {
+    button.burstStartUS = timestampUS;
+  }
+
+  button.rawVal = val;
+  button.lastEdgeUS = timestampUS;
+}
+
+inline void applyButtonEdges(byte values, unsigned long timestampUS) {
+  applyButtonEdge(leftButtonEdges, (values & BUTTON_EDGE_LEFT) ? HIGH : LOW, timestampUS);
+  applyButtonEdge(rightButtonEdges, (values & BUTTON_EDGE_RIGHT) ? HIGH : LOW, timestampUS);
+  applyButtonEdge(utilityButtonEdges, (values & BUTTON_EDGE_UTILITY) ? HIGH : LOW, timestampUS);
+}
+
+// returns true when a changed value has been stable for the debounce delay
+// and the button is now pressed
+inline bool settleButtonPress(ButtonEdgeDebounce& button, unsigned long nowUS) {
+  if (button.rawVal == button.val || nowUS - button.lastEdgeUS <= BUTTON_DEBOUNCE_DELAY_US) {
+    return false;
+  }
+
+  button.val = button.rawVal;
+
+  // using internal pull-up resistor means a pressed button goes LOW
+  return button.val == LOW;
+}
+
+inline void loopCheckButtons(unsigned long loopNow) {
+  ButtonEdge edge;
+  while (popButtonEdge(edge)) {
+    applyButtonEdges(edge.values, edge.timestampUS);
+  }
+
+  // also read the pins directly, which covers any pin without an interrupt
+  // (it's a no-op when the interrupts have already reported the same values)
+  unsigned long nowUS = micros();
+  applyButtonEdges(packButtonValues(readButtonValues()), nowUS);
 
-    setButtonLEDs(leftPlayersTurn, !leftPlayersTurn);
-    notifyNewGame(true, TURN_TIMER_OPTIONS[currentTurnTimerOption].label);
-  } else if (currentClockState == CLOCK_TIMEOUT) {
-    currentClockState = CLOCK_IDLE;
+  if (settleButtonPress(leftButtonEdges, nowUS)) {
+    handleButtonPress(EVENT_LEFT_BUTTON, edgeTimestampMS(leftButtonEdges.burstStartUS, loopNow, nowUS), leftButtonEdges.burstStartUS);
+  }
+  if (settleButtonPress(rightButtonEdges, nowUS)) {
+    handleButtonPress(EVENT_RIGHT_BUTTON, edgeTimestampMS(rightButtonEdges.burstStartUS, loopNow, nowUS), rightButtonEdges.burstStartUS);
+  }
+  if (settleButtonPress(utilityButtonEdges, nowUS)) {
+    handleButtonPress(EVENT_UTILITY_BUTTON, edgeTimestampMS(utilityButtonEdges.burstStartUS, loopNow, nowUS), utilityButtonEdges.burstStartUS);
   }
 }
 
-inline void handleUtilityButtonPress(unsigned long loopNow) {
-  if (currentClockState == CLOCK_IDLE) {
-    currentClockState = CLOCK_MENU;
-  } else if (
-    currentClockState == CLOCK_MENU
-    || currentClockState == CLOCK_TIMEOUT
-    || currentClockState == CLOCK_RUNNING
-  ) {
-    currentClockState = CLOCK_IDLE;
+// true if the active player's button went down within their turn limit, but
+// is still being debounced: the timeout has to wait for it
+inline bool turnEndPending(unsigned long loopNow, unsigned long timeoutLimit) {
+  const ButtonEdgeDebounce& button = leftPlayersTurn ? leftButtonEdges : rightButtonEdges;
+  unsigned long nowUS = micros();
+
+  if (button.val == LOW || (button.rawVal == HIGH && nowUS - button.lastEdgeUS > BUTTON_DEBOUNCE_DELAY_US)) {
+    return false;
   }
+
+  return turnElapsedMS(edgeTimestampMS(button.burstStartUS, loopNow, nowUS), button.burstStartUS) < timeoutLimit;
 }
 
+#else
+
 inline void loopCheckButtons(unsigned long loopNow) {
   ButtonValues vals = readButtonValues();
 
@@ -359,7 +936,7 @@ inline void loopCheckButtons(unsigned long loopNow) {
 
     // using internal pull-up resistor means a pressed button goes LOW
     if (leftButtonVal == LOW) {
-      handleLeftButtonPress(loopNow);
+      handleButtonPress(EVENT_LEFT_BUTTON, loopNow, micros());
     }
   }
 
@@ -370,7 +947,7 @@ inline void loopCheckButtons(unsigned long loopNow) {
 
     // using internal pull-up resistor means a pressed button goes LOW
     if (rightButtonVal == LOW) {
-      handleRightButtonPress(loopNow);
+      handleButtonPress(EVENT_RIGHT_BUTTON, loopNow, micros());
     }
   }
 
@@ -381,7 +958,7 @@ inline void loopCheckButtons(unsigned long loopNow) {
 
     // using internal pull-up resistor means a pressed button goes LOW
     if (utilityButtonVal == LOW) {
-      handleUtilityButtonPress(loopNow);
+      handleButtonPress(EVENT_UTILITY_BUTTON, loopNow, micros());
     }
   }
 
@@ -391,6 +968,62 @@ inline void loopCheckButtons(unsigned long loopNow) {
   utilityButtonLastVal = vals.utility;
 }
 
+inline bool turnEndPending(unsigned long loopNow, unsigned long timeoutLimit) {
+  return false;
+}
+
+#endif
+
+#if defined(CLOCK_SERIAL_COMMANDS)
+
+// single-byte commands received over Serial
+inline void loopSerialCommands(unsigned long loopNow) {
+  releaseSerialButtons(loopNow);
+
+  while (Serial.available() > 0) {
+    char command = Serial.read();
+
+    if (pressSerialButton(command, loopNow)) {
+      continue;
+    }
+
+    #if defined(CLOCK_MOVE_LOG)
+      if (command == 'M') {
+        dumpMoveLog();
+      }
+    #endif
+
+    #if defined(CLOCK_INSTRUMENTATION)
+      if (command == 'I') {
+        requestInstrumentationDump();
+      }
+    #endif
+  }
+}
+
+#else
+
+inline void loopSerialCommands(unsigned long loopNow) {}
+
+#endif
+
+typedef void (*ClockStateLoop)(unsigned long loopNow);
+
+// each state's loop function, in ClockState order
+const ClockStateLoop CLOCK_STATE_LOOPS[] PROGMEM = {
+  loopIdle,               // CLOCK_IDLE
+  loopCountdown,          // CLOCK_RUNNING
+  loopTimeout,            // CLOCK_TIMEOUT
+  loopMenu,               // CLOCK_MENU
+  #if defined(CLOCK_BRIGHTNESS_CONTROL)
+    loopBrightnessScreen  // CLOCK_BRIGHTNESS
+  #else
+    loopIdle              // (unreachable)
+  #endif
+};
+
+static_assert(sizeof(CLOCK_STATE_LOOPS) / sizeof(CLOCK_STATE_LOOPS[0]) == CLOCK_STATE_COUNT, "CLOCK_STATE_LOOPS needs one entry per ClockState");
+
 /*
  * ============================
  *  Main Loop (Continuous)
@@ -398,29 +1031,50 @@ inline void loopCheckButtons(unsigned long loopNow) {
  */
 void loop() {
   unsigned long now = millis();
+  loopTimebase();
+  instrumentLoopStart();
 
   // check for button presses and change state if needed
+  loopSerialCommands(now);
   loopCheckButtons(now);
+  instrumentLap(PHASE_BUTTONS);
   
-  CountdownValues cv = { 0UL, 0UL };
+  turnCountdown = { 0UL, 0UL };
 
   // handle behavior based on current clock state. generally, update the
   // tube display by making changes to multiplexDisplayValues[], and 
-  // occasionally change to other states (e.g. loopCountdown() will change
-  // `currentClockState` to CLOCK_TIMEOUT when appropriate)
-  if (currentClockState == CLOCK_RUNNING) {
-    cv = loopCountdown(now);
-  } else if (currentClockState == CLOCK_TIMEOUT) {
-    cv = { TURN_TIMER_OPTIONS[currentTurnTimerOption].turnLimitMS, 0UL };
-    loopTimeout(now);
-  } else if (currentClockState == CLOCK_MENU) {
-    loopMenu(now);
-  } else if (currentClockState == CLOCK_IDLE) {
-    loopIdle();
-  }
+  // occasionally change to other states (e.g. loopCountdown() dispatches
+  // EVENT_TURN_EXPIRED when appropriate)
+  ClockStateLoop loopState;
+  memcpy_P(&loopState, &CLOCK_STATE_LOOPS[currentClockState], sizeof(loopState));
+  loopState(now);
+
+  // and whichever animation they've started, if its frame has changed
+  loopAnimation(now);
+  instrumentLap(PHASE_STATE);
+
+  // serial output, EEPROM & the light sensor
+  loopSendStatusUpdate(now, turnCountdown.elapsedMS, turnCountdown.remainingMS);
+  loopStackReport(now);
+  loopSerialOutput(now);
+  loopJournal();
+  loopBrightness(now);
+  instrumentLap(PHASE_IO);
+
+  loopPower(now);
+  instrumentSleepLap(PHASE_SLEEP);
 
   // display current values in multiplexDisplayValues[]
   loopMultiplex();
+  instrumentLap(PHASE_MULTIPLEX);
 
   loopHardware(now);
+  instrumentLap(PHASE_HARDWARE);
+
+  instrumentLoopEnd();
+  loopInstrumentation(multiplexLitDurationUS(0));
 }
+
+#if defined(CLOCK_BENCHMARK)
+  #include "clock-benchmark.h"
+#endif
@@ -0,0 +1,150 @@
+/*
+ * ============================================================================
+ * Display Animations
+ *
+ * The blinking menu, brightness & timeout screens, and the jackpot scroll, are
+ * each a sequence of frames in flash: what to show on the six tubes, which
+ * button LEDs to light, and for how long. One animation plays at a time,
+ * timed from when its current frame went up, and loopAnimation() only writes
+ * to the display when the frame changes, so in between, a playing animation
+ * costs loop() a subtraction and a compare.
+ *
+ * An animation plays its frames through `repeats` times, then stops (so 1 is
+ * a one-shot), or with ANIMATION_LOOP, keeps going until another animation is
+ * played or stopAnimation() is called.
+ *
+ * A frame can leave a tube to be filled in when it's drawn: a tube value of
+ * ANIMATION_TUBE_SOURCE is replaced with the value from the source function
+ * given to playAnimation(), called with the tube and the number of frames
+ * shown so far. E.g. the menu blinks whichever option is selected, and with
+ * CLOCK_CATHODE_BALANCING, the jackpot picks each step's digits from their
+ * usage. If what the source would return changes partway through a frame,
+ * redrawAnimationFrame() puts it up.
+ * ============================================================================
+ */
+
+#ifndef _CLOCK_ANIMATION_H
+#define _CLOCK_ANIMATION_H
+
+#include "clock-config.h"
+#include "clock-hardware.h"
+#include "clock-multiplex.h"
+
+// a tube value (digits & BLANK are all < 16)
+const byte ANIMATION_TUBE_SOURCE = 0x80;
+
+const byte ANIMATION_LED_LEFT = 1 << 0;
+const byte ANIMATION_LED_RIGHT = 1 << 1;
+const byte ANIMATION_LEDS_KEEP = 1 << 2;  // leave the LEDs as they are
+
+const byte ANIMATION_LOOP = 0;
+
+#define ANIMATION_FRAME_COUNT(frames) (sizeof(frames) / sizeof((frames)[0]))
+
+typedef struct {
+  byte tubes[TUBE_COUNT];
+  byte leds;
+  uint16_t durationMS;
+} AnimationFrame;
+
+typedef struct {
+  const AnimationFrame* frames;  // in flash
+  byte frameCount;
+  byte repeats;                  // or ANIMATION_LOOP
+} Animation;
+
+// the value for a tube, `step` frames into the animation (wrapping at 256)
+typedef byte (*AnimationSource)(byte tubeIndex, byte step);
+
+const Animation* currentAnimation = NULL;  // in flash, NULL when stopped
+Animation animationPlaying;                // a copy of *currentAnimation
+AnimationSource animationSource = NULL;
+unsigned long animationFrameStartMS = 0UL;
+uint16_t animationFrameDurationMS = 0;
+byte animationFrameIndex = 0;
+byte animationRepeat = 0;
+byte animationStep = 0;
+bool animationFrameDrawn = false;
+
+inline bool animationRunning() {
+  return currentAnimation != NULL;
+}
+
+inline void stopAnimation() {
+  currentAnimation = NULL;
+}
+
+inline void redrawAnimationFrame() {
+  animationFrameDrawn = false;
+}
+
+inline void startAnimationFrame(byte frameIndex, unsigned long loopNow) {
+  animationFrameIndex = frameIndex;
+  animationFrameStartMS = loopNow;
+  animationFrameDurationMS = pgm_read_word(&animationPlaying.frames[frameIndex].durationMS);
+  animationFrameDrawn = false;
+}
+
+// Starts `animation` from its first frame, unless it's already the one
+// playing. Drawn by the next loopAnimation().
+inline void playAnimation(const Animation* animation, unsigned long loopNow, AnimationSource source = NULL) {
+  if (animation == currentAnimation) {
+    return;
+  }
+
+  currentAnimation = animation;
+  memcpy_P(&animationPlaying, animation, sizeof(Animation));
+  animationSource = source;
+  animationRepeat = 0;
+  animationStep = 0;
+  startAnimationFrame(0, loopNow);
+}
+
+inline void drawAnimationFrame() {
+  const AnimationFrame* frame = &animationPlaying.frames[animationFrameIndex];
+  byte tubes[TUBE_COUNT];
+  memcpy_P(tubes, frame->tubes, TUBE_COUNT);
+
+  for (byte i = 0; i < TUBE_COUNT; i++) {
+    if (tubes[i] == ANIMATION_TUBE_SOURCE) {
+      tubes[i] = animationSource(i, animationStep);
+    }
+  }
+  setMultiplexFrame(tubes);
+
+  byte leds = pgm_read_byte(&frame->leds);
+  if (!(leds & ANIMATION_LEDS_KEEP)) {
+    setButtonLEDs(leds & ANIMATION_LED_LEFT, leds & ANIMATION_LED_RIGHT);
+  }
+
+  animationFrameDrawn = true;
+}
+
+inline void loopAnimation(unsigned long loopNow) {
+  if (currentAnimation == NULL) {
+    return;
+  }
+
+  if (loopNow - animationFrameStartMS >= animationFrameDurationMS) {
+    byte next = animationFrameIndex + 1;
+
+    if (next == animationPlaying.frameCount) {
+      next = 0;
+
+      if (animationPlaying.repeats != ANIMATION_LOOP && ++animationRepeat == animationPlaying.repeats) {
+        // whatever was showing before takes the display back
+        currentAnimation = NULL;
+        return;
+      }
+    }
+
+    animationStep++;
+    startAnimationFrame(next, loopNow);
+  }
+
+  if (!animationFrameDrawn) {
+    drawAnimationFrame();
+  }
+}
+
+#endif _CLOCK_ANIMATION_H
@@ -0,0 +1,165 @@
+/*
+ * ============================================================================
+ * Hot Path Benchmarks (CLOCK_BENCHMARK)
+ *
+ * Measures CPU cycles per call of the display & time formatting hot paths,
+ * using the cycle counter from clock-hardware.h, and prints one line per
+ * measurement over Serial:
+ *   BENCH,<function>,<variant>,calls=N,min=C,avg=C,max=C
+ *
+ * setMultiplexClockTime() is measured once per TURN_TIMER_OPTIONS entry, since
+ * the hours, minutes and sub-minute layouts take different branches. Each
+ * measured call runs with interrupts masked, and the counter's own overhead
+ * is subtracted.
+ *
+ * Running:
+ *  - host simulation: npm run bench:host
+ *  - Uno R1-R3 under simavr: npm run bench:avr (needs arduino-cli & simavr)
+ *  - compare two saved runs: npm run bench:compare -- before.txt after.txt
+ * ============================================================================
+ */
+
+#ifndef _CLOCK_BENCHMARK_H
+#define _CLOCK_BENCHMARK_H
+
+const unsigned int BENCHMARK_ITERATIONS = 1000;
+
+typedef struct {
+  CycleCount minCycles;
+  CycleCount maxCycles;
+  unsigned long totalCycles;
+  unsigned int calls;
+} BenchmarkResult;
+
+CycleCount benchmarkOverhead = 0;
+
+#define BENCHMARK_CALL(result, call) { \
+  noInterrupts(); \
+  CycleCount _start = readCycleCounter(); \
+  call; \
+  CycleCount _cycles = (CycleCount)(readCycleCounter() - _start); \
+  interrupts(); \
+  recordBenchmarkCycles(result, _cycles > benchmarkOverhead ? _cycles - benchmarkOverhead : 0); \
+}
+
+inline void recordBenchmarkCycles(BenchmarkResult& result, CycleCount cycles) {
+  if (result.calls == 0 || cycles < result.minCycles) {
+    result.minCycles = cycles;
+  }
+  if (result.calls == 0 || cycles > result.maxCycles) {
+    result.maxCycles = cycles;
+  }
+
+  result.totalCycles += cycles;
+  result.calls++;
+}
+
+inline void printBenchmarkResult(const char* name, const char* variant, const BenchmarkResult& result) {
+  Serial.print("BENCH,");
+  Serial.print(name);
+  Serial.print(",");
+  Serial.print(variant);
+  Serial.print(",calls=");
+  Serial.print(result.calls);
+  Serial.print(",min=");
+  Serial.print((unsigned long)result.minCycles);
+  Serial.print(",avg=");
+  Serial.print(result.calls ? result.totalCycles / result.calls : 0UL);
+  Serial.print(",max=");
+  Serial.println((unsigned long)result.maxCycles);
+}
+
+inline void measureBenchmarkOverhead() {
+  BenchmarkResult result = {};
+  benchmarkOverhead = 0;
+
+  for (unsigned int i = 0; i < BENCHMARK_ITERATIONS; i++) {
+    BENCHMARK_CALL(result, {});
+  }
+
+  benchmarkOverhead = result.minCycles;
+}
+
+inline void benchmarkSetMultiplexClockTime(byte option) {
+  BenchmarkResult result = {};
+  unsigned long limit = turnTimerLimitMS(option);
+  bool displayElapsed = limit == 0UL;
+
+  // start mid-second, away from any whole minute, so the jackpot doesn't kick in
+  unsigned long startElapsedMS = displayElapsed ? 754321UL : 1500UL;
+
+  for (unsigned int i = 0; i < BENCHMARK_ITERATIONS; i++) {
+    unsigned long elapsedMS = startElapsedMS + i;
+    unsigned long remainingMS = limit - elapsedMS;
+    stopAnimation();
+
+    BENCHMARK_CALL(result, setMultiplexClockTime(elapsedMS, remainingMS, elapsedMS, displayElapsed));
+  }
+
+  char label[sizeof(TURN_TIMER_OPTIONS[0].label)];
+  memcpy_P(label, TURN_TIMER_OPTIONS[option].label, sizeof(label));
+  printBenchmarkResult("setMultiplexClockTime", label, result);
+}
+
+inline void benchmarkLoopAnimation() {
+  BenchmarkResult result = {};
+  stopAnimation();
+  #if defined(CLOCK_CATHODE_BALANCING)
+    playAnimation(&JACKPOT_ANIMATION, 0UL, cathodeCycleDigit);
+  #else
+    playAnimation(&JACKPOT_ANIMATION, 0UL);
+  #endif
+
+  // 2ms per call keeps the whole run inside one jackpot (it's 2.5s), so most
+  // calls are between frames, and every 25th draws one
+  for (unsigned int i = 0; i < BENCHMARK_ITERATIONS; i++) {
+    BENCHMARK_CALL(result, loopAnimation(i * 2UL));
+  }
+
+  stopAnimation();
+  printBenchmarkResult("loopAnimation", "jackpot", result);
+}
+
+inline void benchmarkDisplayOnTube() {
+  BenchmarkResult displayResult = {};
+  BenchmarkResult blankResult = {};
+
+  for (unsigned int i = 0; i < BENCHMARK_ITERATIONS; i++) {
+    BENCHMARK_CALL(displayResult, displayOnTube(i % TUBE_COUNT, i % DIGITS_PER_TUBE));
+    BENCHMARK_CALL(blankResult, blankTubes());
+  }
+
+  printBenchmarkResult("displayOnTube", "-", displayResult);
+  printBenchmarkResult("blankTubes", "-", blankResult);
+}
+
+inline void benchmarkLoopCheckButtons() {
+  BenchmarkResult result = {};
+
+  for (unsigned int i = 0; i < BENCHMARK_ITERATIONS; i++) {
+    BENCHMARK_CALL(result, loopCheckButtons(i));
+  }
+
+  printBenchmarkResult("loopCheckButtons", "-", result);
+}
+
+void runBenchmarks() {
+  setupCycleCounter();
+  measureBenchmarkOverhead();
+
+  Serial.print("BENCH,overhead,-,calls=0,min=");
+  Serial.println((unsigned long)benchmarkOverhead);
+
+  for (byte option = 0; option < TURN_TIMER_OPTIONS_COUNT; option++) {
+    benchmarkSetMultiplexClockTime(option);
+  }
+
+  benchmarkLoopAnimation();
+  benchmarkDisplayOnTube();
+  benchmarkLoopCheckButtons();
+
+  Serial.println("BENCH,done");
+  haltAfterBenchmarks();
+}
+
+#endif _CLOCK_BENCHMARK_H
@@ -0,0 +1,138 @@
+/*
+ * ============================================================================
+ * Brightness (CLOCK_BRIGHTNESS_CONTROL)
+ *
+ * The overall brightness is one of BRIGHTNESS_LEVEL_PERCENT[], chosen on the
+ * brightness screen (press the utility button from the menu, then left for
+ * dimmer and right for brighter). It's applied on top of each tube's trim in
+ * clock-multiplex.h, by shortening the tubes' lit phases.
+ *
+ * With an ambient light sensor (AMBIENT_LIGHT_SENSOR_PIN), there's one more
+ * level after the brightest, "auto", which follows the room: the sensor is
+ * sampled a few times a second and smoothed, and the brightness only changes
+ * once the reading has moved by a few percent, so it doesn't flicker between
+ * two values.
+ * ============================================================================
+ */
+
+#ifndef _CLOCK_BRIGHTNESS_H
+#define _CLOCK_BRIGHTNESS_H
+
+#include "clock-config.h"
+#include "clock-multiplex.h"
+
+#if defined(CLOCK_BRIGHTNESS_CONTROL)
+
+const byte BRIGHTNESS_LEVEL_COUNT = 5;
+const byte BRIGHTNESS_LEVEL_PERCENT[BRIGHTNESS_LEVEL_COUNT] = {15, 30, 50, 75, 100};
+
+#if defined(AMBIENT_LIGHT_SENSOR_PIN)
+  const byte BRIGHTNESS_AUTO = BRIGHTNESS_LEVEL_COUNT;
+  const byte BRIGHTNESS_SETTING_COUNT = BRIGHTNESS_LEVEL_COUNT + 1;
+
+  const unsigned long AMBIENT_SAMPLE_INTERVAL_MS = 250UL;
+  const byte AMBIENT_SMOOTHING_SHIFT = 3;  // each sample moves the average 1/8 of the way
+  const byte AMBIENT_DEADBAND_PERCENT = 5;
+  const int AMBIENT_MAX_READING = 1023;
+
+  unsigned int ambientReadingAverage = AMBIENT_MAX_READING << AMBIENT_SMOOTHING_SHIFT;
+  unsigned long lastAmbientSampleTimestampMS = 0UL;
+#else
+  const byte BRIGHTNESS_SETTING_COUNT = BRIGHTNESS_LEVEL_COUNT;
+#endif
+
+byte brightnessSetting = BRIGHTNESS_LEVEL_COUNT - 1;
+byte brightnessPercent = 0; // as last applied
+
+inline void applyBrightnessPercent(byte percent) {
+  if (percent == brightnessPercent) {
+    return;
+  }
+
+  brightnessPercent = percent;
+  setMultiplexBrightness(percent);
+}
+
+#if defined(AMBIENT_LIGHT_SENSOR_PIN)
+
+// the sensor reads higher in a brighter room (e.g. an LDR from 5V to the pin,
+// with a resistor from the pin to ground)
+inline byte ambientBrightnessPercent() {
+  unsigned int reading = ambientReadingAverage >> AMBIENT_SMOOTHING_SHIFT;
+  byte lowest = BRIGHTNESS_LEVEL_PERCENT[0];
+
+  return lowest + (unsigned long)(100 - lowest) * reading / AMBIENT_MAX_READING;
+}
+
+inline void loopAmbientLight(unsigned long loopNow) {
+  if (loopNow - lastAmbientSampleTimestampMS < AMBIENT_SAMPLE_INTERVAL_MS) {
+    return;
+  }
+  lastAmbientSampleTimestampMS = loopNow;
+
+  ambientReadingAverage -= ambientReadingAverage >> AMBIENT_SMOOTHING_SHIFT;
+  ambientReadingAverage += analogRead(AMBIENT_LIGHT_SENSOR_PIN);
+
+  if (brightnessSetting != BRIGHTNESS_AUTO) {
+    return;
+  }
+
+  byte percent = ambientBrightnessPercent();
+  if (percent + AMBIENT_DEADBAND_PERCENT <= brightnessPercent
+    || percent >= brightnessPercent + AMBIENT_DEADBAND_PERCENT) {
+    applyBrightnessPercent(percent);
+  }
+}
+
+#endif
+
+inline void applyBrightnessSetting() {
+  #if defined(AMBIENT_LIGHT_SENSOR_PIN)
+    if (brightnessSetting == BRIGHTNESS_AUTO) {
+      applyBrightnessPercent(ambientBrightnessPercent());
+      return;
+    }
+  #endif
+
+  applyBrightnessPercent(BRIGHTNESS_LEVEL_PERCENT[brightnessSetting]);
+}
+
+inline void setupBrightness() {
+  #if defined(AMBIENT_LIGHT_SENSOR_PIN)
+    pinMode(AMBIENT_LIGHT_SENSOR_PIN, INPUT);
+    ambientReadingAverage = analogRead(AMBIENT_LIGHT_SENSOR_PIN) << AMBIENT_SMOOTHING_SHIFT;
+  #endif
+
+  applyBrightnessSetting();
+}
+
+inline void loopBrightness(unsigned long loopNow) {
+  #if defined(AMBIENT_LIGHT_SENSOR_PIN)
+    loopAmbientLight(loopNow);
+  #endif
+}
+
+// left & right on the brightness screen (no wrapping around, so that holding
+// out for the dimmest setting can't jump to the brightest)
+inline void dimmerBrightnessSetting() {
+  if (brightnessSetting > 0) {
+    brightnessSetting--;
+    applyBrightnessSetting();
+  }
+}
+
+inline void brighterBrightnessSetting() {
+  if (brightnessSetting < BRIGHTNESS_SETTING_COUNT - 1) {
+    brightnessSetting++;
+    applyBrightnessSetting();
+  }
+}
+
+#else
+
+inline void setupBrightness() {}
+inline void loopBrightness(unsigned long loopNow) {}
+
+#endif
+
+#endif _CLOCK_BRIGHTNESS_H
@@ -0,0 +1,122 @@
+/*
+ * ============================================================================
+ * Cathode Wear Balancing (CLOCK_CATHODE_BALANCING)
+ *
+ * A Nixie cathode that's rarely lit slowly gets "poisoned" (sputtered over),
+ * and stops lighting evenly. Which cathodes go unused depends on what's been
+ * shown: the tens of minutes never show 6-9, hour tubes mostly show 0-2, and
+ * the layouts that only use 4 tubes leave the other 2 blank entirely.
+ *
+ * So the multiplexer counts every time it lights each digit of each tube
+ * (a single increment per lit phase), and the once-a-minute "jackpot" scroll
+ * spends its time on each tube's least-used digits instead of stepping every
+ * tube through every digit equally. The counts come from what was actually
+ * lit, so the schedule follows whichever layout has been on the display.
+ *
+ * Counts are 16-bit. Once any of them nears the top, all of them are halved
+ * (from loop(), not the multiplexer), so they also favour recent use.
+ *
+ * The scroll itself is a precomputed sequence in flash, of which usage rank
+ * (0 = least used) to show at each step: 10 of the 50 steps go to the least
+ * used digit, down to 2 for the most used. Each tube starts at a different
+ * point in the sequence, so the tubes don't all change together.
+ * ============================================================================
+ */
+
+#ifndef _CLOCK_CATHODE_WEAR_H
+#define _CLOCK_CATHODE_WEAR_H
+
+#include "clock-config.h"
+
+#if defined(CLOCK_CATHODE_BALANCING)
+
+const uint16_t CATHODE_USAGE_HALVING_THRESHOLD = 0xF000;
+
+const byte CATHODE_CYCLE_STEPS = 50;
+const byte CATHODE_CYCLE_TUBE_OFFSET = 8;
+
+// smooth weighted round robin over ranks, weights 10, 8, 7, 6, 5, 4, 3, 3, 2, 2
+const byte CATHODE_CYCLE_RANKS[CATHODE_CYCLE_STEPS] PROGMEM = {
+  0, 1, 2, 3, 4, 5, 6, 0, 7, 1,
+  2, 8, 0, 3, 9, 4, 1, 0, 2, 5,
+  3, 1, 0, 6, 2, 4, 7, 0, 1, 3,
+  5, 2, 0, 1, 4, 8, 9, 0, 3, 2,
+  1, 6, 0, 7, 5, 4, 3, 2, 1, 0
+};
+
+volatile uint16_t cathodeLitCounts[TUBE_COUNT][DIGITS_PER_TUBE];
+volatile bool cathodeUsageHalvingDue = false;
+
+// each tube's digits, least used first, as of the last rankCathodesByUsage()
+byte cathodeDigitsByUsage[TUBE_COUNT][DIGITS_PER_TUBE];
+
+// called from multiplexStep(), possibly in the multiplex timer interrupt
+inline void countCathodeLit(byte tubeIndex, byte displayVal) {
+  if (displayVal >= DIGITS_PER_TUBE) {
+    return;
+  }
+
+  uint16_t count = cathodeLitCounts[tubeIndex][displayVal];
+  if (count < 0xFFFF) {
+    cathodeLitCounts[tubeIndex][displayVal] = count + 1;
+  }
+  if (count >= CATHODE_USAGE_HALVING_THRESHOLD) {
+    cathodeUsageHalvingDue = true;
+  }
+}
+
+inline void loopCathodeUsage() {
+  if (!cathodeUsageHalvingDue) {
+    return;
+  }
+
+  noInterrupts();
+  for (byte t = 0; t < TUBE_COUNT; t++) {
+    for (byte d = 0; d < DIGITS_PER_TUBE; d++) {
+      cathodeLitCounts[t][d] >>= 1;
+    }
+  }
+  cathodeUsageHalvingDue = false;
+  interrupts();
+}
+
+// once per scroll: an insertion sort of each tube's 10 digits
+inline void rankCathodesByUsage() {
+  uint16_t counts[DIGITS_PER_TUBE];
+
+  for (byte t = 0; t < TUBE_COUNT; t++) {
+    noInterrupts();
+    for (byte d = 0; d < DIGITS_PER_TUBE; d++) {
+      counts[d] = cathodeLitCounts[t][d];
+    }
+    interrupts();
+
+    byte* ranked = cathodeDigitsByUsage[t];
+    for (byte d = 0; d < DIGITS_PER_TUBE; d++) {
+      byte i = d;
+      while (i > 0 && counts[ranked[i - 1]] > counts[d]) {
+        ranked[i] = ranked[i - 1];
+        i--;
+      }
+      ranked[i] = d;
+    }
+  }
+}
+
+inline byte cathodeCycleDigit(byte tubeIndex, byte step) {
+  byte position = step + tubeIndex * CATHODE_CYCLE_TUBE_OFFSET;
+  while (position >= CATHODE_CYCLE_STEPS) {
+    position -= CATHODE_CYCLE_STEPS;
+  }
+
+  return cathodeDigitsByUsage[tubeIndex][pgm_read_byte(&CATHODE_CYCLE_RANKS[position])];
+}
+
+#else
+
+inline void countCathodeLit(byte tubeIndex, byte displayVal) {}
+inline void loopCathodeUsage() {}
+
+#endif
+
+#endif _CLOCK_CATHODE_WEAR_H
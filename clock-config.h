@@ -0,0 +1,104 @@
+/*
+ * ============================================================================
+ * Build Options
+ *
+ * Optional features, enabled by uncommenting the associated #define (or by
+ * passing it as a compiler flag).
+ * ============================================================================
+ */
+
+#ifndef _CLOCK_CONFIG_H
+#define _CLOCK_CONFIG_H
+
+// Run the Nixie tube multiplexing from a hardware timer interrupt instead of
+// polling micros() from loop(), so that slow work in the loop can't stretch
+// tube on-times. Uses Timer1 on the Uno R1-R3, and a free GPT/AGT timer on the
+// Uno R4 WiFi.
+// #define MULTIPLEX_USE_TIMER_ISR
+
+// Time each phase of loop() and each lit tube slot, and print min/max and
+// percentile histograms over Serial when an 'I' is received. See
+// clock-instrumentation.h.
+// #define CLOCK_INSTRUMENTATION
+
+// Run the cycle-count benchmark suite in setup() and print the results over
+// Serial (on hardware, or under simavr), instead of starting the clock
+// normally. See clock-benchmark.h.
+// #define CLOCK_BENCHMARK
+
+// Capture button edges from pin change interrupts (PCINT on the Uno R1-R3, pin
+// IRQs on the Uno R4 WiFi) with a micros() timestamp each, and debounce from
+// those timestamps, so that a press is timed when it actually happened rather
+// than whenever loop() next got around to reading the pins.
+// #define BUTTON_CAPTURE_INTERRUPTS
+
+// Time turns in microseconds from a 64-bit extension of micros(), instead of
+// in millis(). Turn starts, timeouts and the centisecond display are then
+// exact rather than rounded to the loop's millisecond. See clock-timebase.h.
+// #define CLOCK_HIGH_RES_TIMING
+
+// Send the status stream & notification events over Serial as compact,
+// CRC-checked binary frames instead of text lines, with the status streamed at
+// 50Hz rather than once a second. notification-bridge.mjs decodes both. See
+// clock-telemetry.h.
+// #define CLOCK_BINARY_TELEMETRY
+
+// Accept button presses over Serial ('L', 'R' or 'U', one byte per press), for
+// driving the clock from a test harness such as
+// tools/notification-latency.mjs. Leave this off for normal play.
+// #define SERIAL_BUTTON_INPUT
+
+// Queue Serial output from loop() (notifications ahead of the status stream),
+// and only ever write as much as fits in the transmit buffer, so that Serial
+// can't hold up the display. Messages that don't fit in their queue are
+// dropped & counted, and reported in a CCSERIAL line. See clock-serial-out.h.
+// #define SERIAL_TX_SCHEDULER
+
+// Keep a log of the time taken by every move of the current game (a few
+// hundred moves, in under 400 bytes of RAM), and dump it over Serial when an
+// 'M' is received. See clock-move-log.h.
+// #define CLOCK_MOVE_LOG
+
+// Save power: sleep the CPU while idle (until a button is pressed), and during
+// 24h+ correspondence turns, turn the tubes & LEDs off after 30s without a
+// press (the next press only wakes the display), sleeping between millis()
+// ticks so that the turn is still timed exactly. See clock-power.h.
+// #define CLOCK_LOW_POWER
+
+// Count how long each digit of each tube has been lit, and have the
+// once-a-minute scroll spend its time on the least-used cathodes, to stave
+// off cathode poisoning. See clock-cathode-wear.h.
+// #define CLOCK_CATHODE_BALANCING
+
+// Dim the display: per-tube brightness trim (TUBE_BRIGHTNESS_TRIM_PERCENT in
+// clock-multiplex.h), and an overall brightness set from a screen after the
+// menu (utility button from the menu, then left/right). Best combined with
+// MULTIPLEX_USE_TIMER_ISR, which times the shortened phases exactly. See
+// clock-brightness.h.
+// #define CLOCK_BRIGHTNESS_CONTROL
+
+// Follow the room's light level with an ambient light sensor on this analog
+// pin (brighter reads higher), as an "auto" brightness setting. All of A0-A5
+// are taken with the stock wiring, so this needs one freed up, e.g. A5, by
+// wiring the buttons' common to GND instead. Requires CLOCK_BRIGHTNESS_CONTROL.
+// #define AMBIENT_LIGHT_SENSOR_PIN A5
+
+// Report how deep the stack has gone over Serial, in a CCSTACK line every 10s,
+// by painting the free RAM at reset and checking how much has been written
+// over. Uno R1-R3 only. tools/memory-budget.mjs checks the result against a
+// budget. See clock-stack.h.
+// #define CLOCK_STACK_REPORT
+
+// Keep the game in progress in EEPROM (a short record each turn, spread across
+// all of it to spread the wear), so it carries on after a power cut. On the
+// Uno R4 WiFi, with a battery on VRTC, its real-time clock keeps counting the
+// turn while the power's off; otherwise the turn starts over. See
+// clock-journal.h.
+// #define CLOCK_GAME_JOURNAL
+
+// features that read single-byte commands from Serial (see loopSerialCommands())
+#if defined(SERIAL_BUTTON_INPUT) || defined(CLOCK_MOVE_LOG) || defined(CLOCK_INSTRUMENTATION)
+  #define CLOCK_SERIAL_COMMANDS
+#endif
+
+#endif _CLOCK_CONFIG_H
@@ -9,7 +9,27 @@
 #ifndef _CLOCK_DATA_TYPES_H
 #define _CLOCK_DATA_TYPES_H
 
-enum ClockState { CLOCK_IDLE, CLOCK_RUNNING, CLOCK_TIMEOUT, CLOCK_MENU };
+// CLOCK_BRIGHTNESS is only reachable with CLOCK_BRIGHTNESS_CONTROL
+enum ClockState { CLOCK_IDLE, CLOCK_RUNNING, CLOCK_TIMEOUT, CLOCK_MENU, CLOCK_BRIGHTNESS, CLOCK_STATE_COUNT };
+
+// what the state machine reacts to, and what it can do on the way into the
+// next state (see CLOCK_TRANSITIONS in arduinix-chess-clock.ino)
+enum ClockEvent { EVENT_LEFT_BUTTON, EVENT_RIGHT_BUTTON, EVENT_UTILITY_BUTTON, EVENT_TURN_EXPIRED, CLOCK_EVENT_COUNT };
+enum ClockAction {
+  ACTION_NONE,
+  ACTION_START_GAME,
+  ACTION_END_TURN,
+  ACTION_EXPIRE_TURN,
+  ACTION_STEP_MENU,
+  ACTION_STEP_BRIGHTNESS,
+  ACTION_END_GAME,
+  CLOCK_ACTION_COUNT
+};
+
+typedef struct {
+  byte next;    // ClockState
+  byte action;  // ClockAction
+} ClockTransition;
 
 typedef struct {
   byte displayValues[TUBE_COUNT];
@@ -22,8 +42,19 @@ typedef struct {
   unsigned long remainingMS;
 } CountdownValues;
 
+// debounce state for one button, fed from timestamped edges
+// (BUTTON_CAPTURE_INTERRUPTS)
+typedef struct {
+  byte rawVal;                // latest value seen, bounces included
+  byte val;                   // debounced value
+  unsigned long lastEdgeUS;
+  unsigned long burstStartUS; // first edge after the pin had been quiet
+} ButtonEdgeDebounce;
+
+// The option tables are in flash (PROGMEM), so read them with pgm_read_*() or
+// memcpy_P(), and treat their labels as flash strings (see serialPrintFlash()).
 const byte TURN_TIMER_OPTIONS_COUNT = 13;
-const TurnTimerOption TURN_TIMER_OPTIONS[TURN_TIMER_OPTIONS_COUNT] = {
+const TurnTimerOption TURN_TIMER_OPTIONS[TURN_TIMER_OPTIONS_COUNT] PROGMEM = {
   { { 7, 2, BLANK, BLANK, BLANK, BLANK }, 259201000UL, "72h" },
   { { 4, 8, BLANK, BLANK, BLANK, BLANK }, 172801000UL, "48h" },
   { { 2, 4, BLANK, BLANK, BLANK, BLANK }, 86401000UL, "24h" },
@@ -39,4 +70,55 @@ const TurnTimerOption TURN_TIMER_OPTIONS[TURN_TIMER_OPTIONS_COUNT] = {
   { { BLANK, BLANK, BLANK, BLANK, BLANK, 0 }, 0UL, "n0L" }
 };
 
+inline unsigned long turnTimerLimitMS(byte option) {
+  return pgm_read_dword(&TURN_TIMER_OPTIONS[option].turnLimitMS);
+}
+
+// Tournament time controls: each player has their own bank of time, which
+// only runs down during their turns. These follow TURN_TIMER_OPTIONS in the
+// menu, and show as:
+//   base minutes | moves in the first stage, or Bronstein delay | increment
+//
+// Times are kept in seconds here, so that the table stays small in flash.
+enum IncrementType { INCREMENT_FISCHER, INCREMENT_BRONSTEIN };
+
+const byte TIME_CONTROL_MAX_STAGES = 2;
+
+typedef struct {
+  byte moves;                 // moves to make within this stage, 0 for the rest of the game
+  unsigned int bankSeconds;   // added to each player's bank as they enter the stage
+} TimeControlStage;
+
+typedef struct {
+  byte displayValues[TUBE_COUNT];
+  IncrementType incrementType;
+  byte incrementSeconds;      // Fischer: added after each move, Bronstein: delay before the bank runs
+  byte stageCount;
+  TimeControlStage stages[TIME_CONTROL_MAX_STAGES];
+  char label[9];
+} TimeControlOption;
+
+typedef struct {
+  unsigned long bankMS;       // what's left, as of the start of the player's current / next turn
+  byte stage;
+  byte stageMoves;            // moves made in the current stage
+  #if defined(CLOCK_HIGH_RES_TIMING)
+    unsigned int usedSubMsUS; // turn time below a whole ms, carried to the next turn
+  #endif
+} PlayerBank;
+
+const byte TIME_CONTROL_OPTIONS_COUNT = 7;
+const TimeControlOption TIME_CONTROL_OPTIONS[TIME_CONTROL_OPTIONS_COUNT] PROGMEM = {
+  { { BLANK, 1, BLANK, BLANK, BLANK, 0 }, INCREMENT_FISCHER, 0, 1, { { 0, 60 } }, "1+0" },
+  { { BLANK, 3, BLANK, BLANK, BLANK, 2 }, INCREMENT_FISCHER, 2, 1, { { 0, 180 } }, "3+2" },
+  { { BLANK, 5, BLANK, BLANK, BLANK, 3 }, INCREMENT_FISCHER, 3, 1, { { 0, 300 } }, "5+3" },
+  { { BLANK, 5, BLANK, 3, BLANK, BLANK }, INCREMENT_BRONSTEIN, 3, 1, { { 0, 300 } }, "5d3" },
+  { { 1, 5, BLANK, BLANK, 1, 0 }, INCREMENT_FISCHER, 10, 1, { { 0, 900 } }, "15+10" },
+  { { 9, 0, BLANK, BLANK, 3, 0 }, INCREMENT_FISCHER, 30, 1, { { 0, 5400 } }, "90+30" },
+  { { 9, 0, 4, 0, 3, 0 }, INCREMENT_FISCHER, 30, 2, { { 40, 5400 }, { 0, 1800 } }, "40/90+30" }
+};
+
+// the menu offers TURN_TIMER_OPTIONS first, then TIME_CONTROL_OPTIONS
+const byte MENU_OPTIONS_COUNT = TURN_TIMER_OPTIONS_COUNT + TIME_CONTROL_OPTIONS_COUNT;
+
 #endif _CLOCK_DATA_TYPES_H
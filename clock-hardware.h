@@ -16,7 +16,28 @@
 #ifndef _CLOCK_HARDWARE_H
 #define _CLOCK_HARDWARE_H
 
+#include "clock-config.h"
 #include "clock-strings.h"
+#include "clock-serial-out.h"
+#include "clock-telemetry.h"
+
+enum NotificationType {
+  NEW_GAME = 0,
+  PLAYER_TURN = 1,
+  TIMEOUT = 2
+};
+
+// text format: CCNTFY,<type>,<leftPlayersTurn>,<label>
+// (labels are flash strings, see clock-data-types.h)
+inline void printNotificationLine(NotificationType type, bool leftPlayersTurn, const char* label) {
+  serialMessageBegin(SERIAL_NOTIFICATIONS);
+  serialPrintFlash(PSTR("CCNTFY,"));
+  serialPrintNumber(type);
+  serialPrint(leftPlayersTurn ? ",1," : ",0,");
+  serialPrintFlash(label);
+  serialPrintln();
+  serialMessageEnd();
+}
 
 #if defined(ARDUINO_UNOWIFIR4)
   #include "clock-wifi.h"
@@ -62,8 +83,8 @@ const byte PIN_BUTTON_GROUND = A5;
 // light the decimal, if the anode is also active).
 const byte TUBE_COUNT = 6;
 const byte DIGITS_PER_TUBE = 10;
-const byte TUBE_ANODES[TUBE_COUNT] = {1, 1, 2, 2, 3, 3};
-const bool TUBE_CATHODE_CTRL_0[TUBE_COUNT] = {false, true, false, true, false, true};
+constexpr byte TUBE_ANODES[TUBE_COUNT] = {1, 1, 2, 2, 3, 3};
+constexpr bool TUBE_CATHODE_CTRL_0[TUBE_COUNT] = {false, true, false, true, false, true};
 
 const int HV_STABILIZATION_DELAY_US = 15;
 
@@ -71,10 +92,10 @@ const int HV_STABILIZATION_DELAY_US = 15;
 const byte BLANK = 15;
 
 // ИH-12A tubes
-const byte TUBE_DIGIT_ORDER[] = {3, 8, 9, 4, 0, 5, 7, 2, 6, 1};
+constexpr byte TUBE_DIGIT_ORDER[] PROGMEM = {3, 8, 9, 4, 0, 5, 7, 2, 6, 1};
 
 // most other tubes
-// const byte TUBE_DIGIT_ORDER[] = {6, 7, 5, 8, 4, 3, 9, 2, 0, 1};
+// constexpr byte TUBE_DIGIT_ORDER[] PROGMEM = {6, 7, 5, 8, 4, 3, 9, 2, 0, 1};
 
 // display number cathode bit position to BCD К155ИД1/SN74141 input constants
 const byte BIT_0_BCD_PIN_A = 1 << 0;
@@ -82,12 +103,79 @@ const byte BIT_1_BCD_PIN_B = 1 << 1;
 const byte BIT_2_BCD_PIN_C = 1 << 2;
 const byte BIT_3_BCD_PIN_D = 1 << 3;
 
+/*
+ * ============================================================================
+ * Serial Button Input (SERIAL_BUTTON_INPUT only)
+ *
+ * Presses a button for SERIAL_BUTTON_HOLD_MS whenever its letter ('L', 'R' or
+ * 'U') arrives over Serial, as if it had been pressed by hand, so that a test
+ * harness (see tools/notification-latency.mjs) can play the clock without
+ * anyone at the buttons. Injected presses are merged into readButtonValues(),
+ * so they're debounced and handled exactly like real ones.
+ * ============================================================================
+ */
+const byte SERIAL_BUTTON_LEFT = 1 << 0;
+const byte SERIAL_BUTTON_RIGHT = 1 << 1;
+const byte SERIAL_BUTTON_UTILITY = 1 << 2;
+
+#if defined(SERIAL_BUTTON_INPUT)
+
+const unsigned long SERIAL_BUTTON_HOLD_MS = 100UL;
+
+byte serialPressedButtons = 0;
+unsigned long serialButtonPressedAt = 0UL;
+
+inline bool serialButtonPressed(byte button) {
+  return serialPressedButtons & button;
+}
+
+// called with each byte received over Serial (see loopSerialCommands()):
+// returns false if it isn't a button
+inline bool pressSerialButton(char command, unsigned long loopNow) {
+  byte button = 0;
+
+  switch (command) {
+    case 'L': button = SERIAL_BUTTON_LEFT; break;
+    case 'R': button = SERIAL_BUTTON_RIGHT; break;
+    case 'U': button = SERIAL_BUTTON_UTILITY; break;
+    default: return false;
+  }
+
+  serialPressedButtons |= button;
+  serialButtonPressedAt = loopNow;
+  return true;
+}
+
+inline void releaseSerialButtons(unsigned long loopNow) {
+  if (serialPressedButtons && loopNow - serialButtonPressedAt >= SERIAL_BUTTON_HOLD_MS) {
+    serialPressedButtons = 0;
+  }
+}
+
+#else
+
+inline bool serialButtonPressed(byte button) {
+  return false;
+}
+
+inline bool pressSerialButton(char command, unsigned long loopNow) {
+  return false;
+}
+
+inline void releaseSerialButtons(unsigned long loopNow) {}
+
+#endif
+
 /*
  * ============================================================================
  *  Hardware-Specific Code - Arduino Uno R1-R3 - AVR-based 
+ *
+ *  Also used by the host simulation build (CLOCK_HOST_SIM), where PORTB,
+ *  PORTC, PORTD and PINC are a virtual register file provided by
+ *  sim/clock-sim-hal.h, so the same port-level code is exercised.
  * ============================================================================
  */
-#if defined(ARDUINO_AVR_UNO)
+#if defined(ARDUINO_AVR_UNO) || defined(CLOCK_HOST_SIM)
 
 const long SERIAL_SPEED_BAUD = 115200L;
 
@@ -112,13 +200,13 @@ const byte PIN_BUTTON_GROUND_DPM_BIT = 1 << 5;      // pin A5 (19): PORTC bit 5
 
 inline ButtonValues readButtonValues() {
   return {
-    (PINC & PIN_BUTTON_LEFT_DPM_BIT) ? HIGH : LOW,
-    (PINC & PIN_BUTTON_RIGHT_DPM_BIT) ? HIGH : LOW,
-    (PINC & PIN_BUTTON_UTILITY_DPM_BIT) ? HIGH : LOW
+    (byte)((PINC & PIN_BUTTON_LEFT_DPM_BIT) && !serialButtonPressed(SERIAL_BUTTON_LEFT) ? HIGH : LOW),
+    (byte)((PINC & PIN_BUTTON_RIGHT_DPM_BIT) && !serialButtonPressed(SERIAL_BUTTON_RIGHT) ? HIGH : LOW),
+    (byte)((PINC & PIN_BUTTON_UTILITY_DPM_BIT) && !serialButtonPressed(SERIAL_BUTTON_UTILITY) ? HIGH : LOW)
   };
 }
 
-inline void setButtonLEDs(bool leftOn, bool rightOn) {
+inline void writeButtonLEDs(bool leftOn, bool rightOn) {
   if (leftOn) {
     PORTC |= PIN_BUTTON_LEFT_LED_DPM_BIT;
   } else {
@@ -153,99 +241,99 @@ inline void blankTubes() {
   PORTB |= (PIN_CATHODE_1_C_DPM_BIT | PIN_CATHODE_1_D_DPM_BIT);
 }
 
+// Final port masks for every [tube][digit] combination, generated at compile
+// time from the pin constants above, so that displayOnTube() is just a few
+// straight-line port writes. Kept in flash (300 bytes) rather than SRAM.
+typedef struct {
+  byte portBSet;
+  byte portBClear;
+  byte portDSet;
+  byte portDClear;
+  byte portBAnode;
+} TubePortMasks;
+
+constexpr byte cathodeBitIf(byte displayVal, byte bcdBit, byte portBit) {
+  return (displayVal & bcdBit) ? portBit : 0;
+}
+
+// controller 0 is wired entirely to PORTD, controller 1 is split across PORTD (A, B) and PORTB (C, D)
+constexpr byte cathodePortDPins(bool cathodeCtrl0) {
+  return cathodeCtrl0
+    ? (PIN_CATHODE_0_A_DPM_BIT | PIN_CATHODE_0_B_DPM_BIT | PIN_CATHODE_0_C_DPM_BIT | PIN_CATHODE_0_D_DPM_BIT)
+    : (PIN_CATHODE_1_A_DPM_BIT | PIN_CATHODE_1_B_DPM_BIT);
+}
+
+constexpr byte cathodePortBPins(bool cathodeCtrl0) {
+  return cathodeCtrl0 ? 0 : (PIN_CATHODE_1_C_DPM_BIT | PIN_CATHODE_1_D_DPM_BIT);
+}
+
+constexpr byte cathodePortDSet(bool cathodeCtrl0, byte displayVal) {
+  return cathodeCtrl0
+    ? (cathodeBitIf(displayVal, BIT_0_BCD_PIN_A, PIN_CATHODE_0_A_DPM_BIT)
+      | cathodeBitIf(displayVal, BIT_1_BCD_PIN_B, PIN_CATHODE_0_B_DPM_BIT)
+      | cathodeBitIf(displayVal, BIT_2_BCD_PIN_C, PIN_CATHODE_0_C_DPM_BIT)
+      | cathodeBitIf(displayVal, BIT_3_BCD_PIN_D, PIN_CATHODE_0_D_DPM_BIT))
+    : (cathodeBitIf(displayVal, BIT_0_BCD_PIN_A, PIN_CATHODE_1_A_DPM_BIT)
+      | cathodeBitIf(displayVal, BIT_1_BCD_PIN_B, PIN_CATHODE_1_B_DPM_BIT));
+}
+
+constexpr byte cathodePortBSet(bool cathodeCtrl0, byte displayVal) {
+  return cathodeCtrl0
+    ? 0
+    : (cathodeBitIf(displayVal, BIT_2_BCD_PIN_C, PIN_CATHODE_1_C_DPM_BIT)
+      | cathodeBitIf(displayVal, BIT_3_BCD_PIN_D, PIN_CATHODE_1_D_DPM_BIT));
+}
+
+constexpr byte anodePortBBit(byte anode) {
+  return anode == 1 ? PIN_ANODE_1_DPM_BIT
+    : anode == 2 ? PIN_ANODE_2_DPM_BIT
+    : anode == 3 ? PIN_ANODE_3_DPM_BIT
+    : PIN_ANODE_4_DPM_BIT;
+}
+
+constexpr TubePortMasks tubePortMasks(byte tubeIndex, byte displayVal) {
+  return {
+    cathodePortBSet(TUBE_CATHODE_CTRL_0[tubeIndex], displayVal),
+    (byte)(cathodePortBPins(TUBE_CATHODE_CTRL_0[tubeIndex]) & ~cathodePortBSet(TUBE_CATHODE_CTRL_0[tubeIndex], displayVal)),
+    cathodePortDSet(TUBE_CATHODE_CTRL_0[tubeIndex], displayVal),
+    (byte)(cathodePortDPins(TUBE_CATHODE_CTRL_0[tubeIndex]) & ~cathodePortDSet(TUBE_CATHODE_CTRL_0[tubeIndex], displayVal)),
+    anodePortBBit(TUBE_ANODES[tubeIndex])
+  };
+}
+
+#define TUBE_PORT_MASKS_ROW(t) { \
+  tubePortMasks(t, 0), tubePortMasks(t, 1), tubePortMasks(t, 2), tubePortMasks(t, 3), tubePortMasks(t, 4), \
+  tubePortMasks(t, 5), tubePortMasks(t, 6), tubePortMasks(t, 7), tubePortMasks(t, 8), tubePortMasks(t, 9) \
+}
+
+const TubePortMasks TUBE_PORT_MASKS[TUBE_COUNT][DIGITS_PER_TUBE] PROGMEM = {
+  TUBE_PORT_MASKS_ROW(0), TUBE_PORT_MASKS_ROW(1), TUBE_PORT_MASKS_ROW(2),
+  TUBE_PORT_MASKS_ROW(3), TUBE_PORT_MASKS_ROW(4), TUBE_PORT_MASKS_ROW(5)
+};
+
 inline void displayOnTube(byte tubeIndex, byte displayVal) {
-  if (displayVal == BLANK) {
+  // also covers BLANK
+  if (displayVal >= DIGITS_PER_TUBE) {
     return;
   }
 
-  byte anode = TUBE_ANODES[tubeIndex];
-  bool cathodeCtrl0 = TUBE_CATHODE_CTRL_0[tubeIndex];
-
-  byte portBHighBitmask, portBLowBitmask, portDHighBitmask, portDLowBitmask;
-  portBHighBitmask = portBLowBitmask = portDHighBitmask = portDLowBitmask = 0;
-  
-  byte cathodeA = displayVal & BIT_0_BCD_PIN_A;
-  byte cathodeB = displayVal & BIT_1_BCD_PIN_B;
-  byte cathodeC = displayVal & BIT_2_BCD_PIN_C;
-  byte cathodeD = displayVal & BIT_3_BCD_PIN_D;
-
-  if (cathodeCtrl0) {
-    if (cathodeA) {
-      portDHighBitmask |= PIN_CATHODE_0_A_DPM_BIT;
-    } else {
-      portDLowBitmask |= PIN_CATHODE_0_A_DPM_BIT;
-    }
-    if (cathodeB) {
-      portDHighBitmask |= PIN_CATHODE_0_B_DPM_BIT;
-    } else {
-      portDLowBitmask |= PIN_CATHODE_0_B_DPM_BIT;
-    }
-    if (cathodeC) {
-      portDHighBitmask |= PIN_CATHODE_0_C_DPM_BIT;
-    } else {
-      portDLowBitmask |= PIN_CATHODE_0_C_DPM_BIT;
-    }
-    if (cathodeD) {
-      portDHighBitmask |= PIN_CATHODE_0_D_DPM_BIT;
-    } else {
-      portDLowBitmask |= PIN_CATHODE_0_D_DPM_BIT;
-    }
-  } else {
-    if (cathodeA) {
-      portDHighBitmask |= PIN_CATHODE_1_A_DPM_BIT;
-    } else {
-      portDLowBitmask |= PIN_CATHODE_1_A_DPM_BIT;
-    }
-    if (cathodeB) {
-      portDHighBitmask |= PIN_CATHODE_1_B_DPM_BIT;
-    } else {
-      portDLowBitmask |= PIN_CATHODE_1_B_DPM_BIT;
-    }
-    if (cathodeC) {
-      portBHighBitmask |= PIN_CATHODE_1_C_DPM_BIT;
-    } else {
-      portBLowBitmask |= PIN_CATHODE_1_C_DPM_BIT;
-    }
-    if (cathodeD) {
-      portBHighBitmask |= PIN_CATHODE_1_D_DPM_BIT;
-    } else {
-      portBLowBitmask |= PIN_CATHODE_1_D_DPM_BIT;
-    }
-  }
+  const TubePortMasks* masks = &TUBE_PORT_MASKS[tubeIndex][displayVal];
 
-  PORTB &= ~portBLowBitmask;
-  PORTD &= ~portDLowBitmask;
-  PORTB |= portBHighBitmask;
-  PORTD |= portDHighBitmask;
+  PORTB = (PORTB & ~pgm_read_byte(&masks->portBClear)) | pgm_read_byte(&masks->portBSet);
+  PORTD = (PORTD & ~pgm_read_byte(&masks->portDClear)) | pgm_read_byte(&masks->portDSet);
 
   delayMicroseconds(HV_STABILIZATION_DELAY_US);
 
   // set high anode pin
-  switch (anode) {
-    case 1:
-      PORTB |= PIN_ANODE_1_DPM_BIT;
-      break;
-    case 2:
-      PORTB |= PIN_ANODE_2_DPM_BIT;
-      break;
-    case 3:
-      PORTB |= PIN_ANODE_3_DPM_BIT;
-      break;
-  }
+  PORTB |= pgm_read_byte(&masks->portBAnode);
 }
 
-enum NotificationType {
-  NEW_GAME = 0,
-  PLAYER_TURN = 1,
-  TIMEOUT = 2
-};
-
-const char* SERIAL_NOTIFICATION = "CCNTFY,%d,%d,%s";
-
 inline void notify(NotificationType type, bool leftPlayersTurn, const char* label) {
-  char buffer[15] = "";
-  snprintf(buffer, 15, SERIAL_NOTIFICATION, type, leftPlayersTurn, label);
-  Serial.println(buffer);
+  #if defined(CLOCK_BINARY_TELEMETRY)
+    sendTelemetryNotification(type, leftPlayersTurn, label);
+  #else
+    printNotificationLine(type, leftPlayersTurn, label);
+  #endif
 }
 
 inline void notifyNewGame(bool leftPlayersTurn, const char* label) {
@@ -253,11 +341,11 @@ inline void notifyNewGame(bool leftPlayersTurn, const char* label) {
 }
 
 inline void notifyPlayerTurn(bool leftPlayersTurn) {
-  notify(PLAYER_TURN, leftPlayersTurn, "-");
+  notify(PLAYER_TURN, leftPlayersTurn, NO_LABEL);
 }
 
 inline void notifyTimeout(bool leftPlayersTurn) {
-  notify(TIMEOUT, leftPlayersTurn, "-");
+  notify(TIMEOUT, leftPlayersTurn, NO_LABEL);
 }
 
 /*
@@ -290,13 +378,13 @@ const uint16_t PIN_BUTTON_GROUND_DPM_BIT = digitalPinToBitMask(A5);
 
 inline ButtonValues readButtonValues() {
   return {
-    (R_PORT0->PIDR & PIN_BUTTON_LEFT_DPM_BIT) ? HIGH : LOW,
-    (R_PORT0->PIDR & PIN_BUTTON_RIGHT_DPM_BIT) ? HIGH : LOW,
-    (R_PORT1->PIDR & PIN_BUTTON_UTILITY_DPM_BIT) ? HIGH : LOW
+    (byte)((R_PORT0->PIDR & PIN_BUTTON_LEFT_DPM_BIT) && !serialButtonPressed(SERIAL_BUTTON_LEFT) ? HIGH : LOW),
+    (byte)((R_PORT0->PIDR & PIN_BUTTON_RIGHT_DPM_BIT) && !serialButtonPressed(SERIAL_BUTTON_RIGHT) ? HIGH : LOW),
+    (byte)((R_PORT1->PIDR & PIN_BUTTON_UTILITY_DPM_BIT) && !serialButtonPressed(SERIAL_BUTTON_UTILITY) ? HIGH : LOW)
   };
 }
 
-inline void setButtonLEDs(bool leftOn, bool rightOn) {
+inline void writeButtonLEDs(bool leftOn, bool rightOn) {
   if (leftOn) {
     R_PORT0->POSR = PIN_BUTTON_LEFT_LED_DPM_BIT;
   } else {
@@ -329,79 +417,170 @@ inline void blankTubes() {
   R_PORT3->POSR = PIN_CATHODE_1_D_DPM_BIT;
 }
 
-inline void displayOnTube(byte tubeIndex, byte displayVal) {
-  if (displayVal == BLANK) {
-    return;
-  }
+// Final PCNTR3 words (PORR in the upper half-word, POSR in the lower) for every
+// [tube][digit] combination, so that displayOnTube() is just a few straight-line
+// port writes. digitalPinToBitMask() is resolved through the core's runtime pin
+// table rather than at compile time, so this is filled in once by
+// setupTubePortMasks() instead.
+typedef struct {
+  uint32_t port1Cntr3;
+  uint32_t port3Cntr3;
+} TubePortMasks;
 
-  byte anode = TUBE_ANODES[tubeIndex];
-  bool cathodeCtrl0 = TUBE_CATHODE_CTRL_0[tubeIndex];
-
-  byte cathodeA = displayVal & BIT_0_BCD_PIN_A;
-  byte cathodeB = displayVal & BIT_1_BCD_PIN_B;
-  byte cathodeC = displayVal & BIT_2_BCD_PIN_C;
-  byte cathodeD = displayVal & BIT_3_BCD_PIN_D;
-  
-  if (cathodeCtrl0) {
-    if (cathodeA) {
-      R_PORT1->POSR = PIN_CATHODE_0_A_DPM_BIT;
-    } else {
-      R_PORT1->PORR = PIN_CATHODE_0_A_DPM_BIT;
-    }
-    if (cathodeB) {
-      R_PORT1->POSR = PIN_CATHODE_0_B_DPM_BIT;
-    } else {
-      R_PORT1->PORR = PIN_CATHODE_0_B_DPM_BIT;
-    }
-    if (cathodeC) {
-      R_PORT1->POSR = PIN_CATHODE_0_C_DPM_BIT;
-    } else {
-      R_PORT1->PORR = PIN_CATHODE_0_C_DPM_BIT;
-    }
-    if (cathodeD) {
-      R_PORT1->POSR = PIN_CATHODE_0_D_DPM_BIT;
-    } else {
-      R_PORT1->PORR = PIN_CATHODE_0_D_DPM_BIT;
-    }
-  } else {
-    if (cathodeA) {
-      R_PORT1->POSR = PIN_CATHODE_1_A_DPM_BIT;
-    } else {
-      R_PORT1->PORR = PIN_CATHODE_1_A_DPM_BIT;
-    }
-    if (cathodeB) {
-      R_PORT1->POSR = PIN_CATHODE_1_B_DPM_BIT;
-    } else {
-      R_PORT1->PORR = PIN_CATHODE_1_B_DPM_BIT;
-    }
-    if (cathodeC) {
-      R_PORT3->POSR = PIN_CATHODE_1_C_DPM_BIT;
-    } else {
-      R_PORT3->PORR = PIN_CATHODE_1_C_DPM_BIT;
+TubePortMasks tubePortMasks[TUBE_COUNT][DIGITS_PER_TUBE];
+R_PORT0_Type* tubeAnodePorts[TUBE_COUNT];
+uint16_t tubeAnodeBits[TUBE_COUNT];
+
+inline uint32_t portCntr3Word(uint16_t pins, uint16_t setBits) {
+  return ((uint32_t)(pins & ~setBits) << 16) | setBits;
+}
+
+inline uint16_t cathodeBitIf(byte displayVal, byte bcdBit, uint16_t portBit) {
+  return (displayVal & bcdBit) ? portBit : 0;
+}
+
+inline void setupTubePortMasks() {
+  for (byte tubeIndex = 0; tubeIndex < TUBE_COUNT; tubeIndex++) {
+    for (byte displayVal = 0; displayVal < DIGITS_PER_TUBE; displayVal++) {
+      if (TUBE_CATHODE_CTRL_0[tubeIndex]) {
+        // controller 0 is wired entirely to PORT1
+        tubePortMasks[tubeIndex][displayVal] = {
+          portCntr3Word(
+            PIN_CATHODE_0_A_DPM_BIT | PIN_CATHODE_0_B_DPM_BIT | PIN_CATHODE_0_C_DPM_BIT | PIN_CATHODE_0_D_DPM_BIT,
+            cathodeBitIf(displayVal, BIT_0_BCD_PIN_A, PIN_CATHODE_0_A_DPM_BIT)
+              | cathodeBitIf(displayVal, BIT_1_BCD_PIN_B, PIN_CATHODE_0_B_DPM_BIT)
+              | cathodeBitIf(displayVal, BIT_2_BCD_PIN_C, PIN_CATHODE_0_C_DPM_BIT)
+              | cathodeBitIf(displayVal, BIT_3_BCD_PIN_D, PIN_CATHODE_0_D_DPM_BIT)
+          ),
+          0UL
+        };
+      } else {
+        // controller 1 is split across PORT1 (A, B) and PORT3 (C, D)
+        tubePortMasks[tubeIndex][displayVal] = {
+          portCntr3Word(
+            PIN_CATHODE_1_A_DPM_BIT | PIN_CATHODE_1_B_DPM_BIT,
+            cathodeBitIf(displayVal, BIT_0_BCD_PIN_A, PIN_CATHODE_1_A_DPM_BIT)
+              | cathodeBitIf(displayVal, BIT_1_BCD_PIN_B, PIN_CATHODE_1_B_DPM_BIT)
+          ),
+          portCntr3Word(
+            PIN_CATHODE_1_C_DPM_BIT | PIN_CATHODE_1_D_DPM_BIT,
+            cathodeBitIf(displayVal, BIT_2_BCD_PIN_C, PIN_CATHODE_1_C_DPM_BIT)
+              | cathodeBitIf(displayVal, BIT_3_BCD_PIN_D, PIN_CATHODE_1_D_DPM_BIT)
+          )
+        };
+      }
     }
-    if (cathodeD) {
-      R_PORT3->POSR = PIN_CATHODE_1_D_DPM_BIT;
-    } else {
-      R_PORT3->PORR = PIN_CATHODE_1_D_DPM_BIT;
+
+    switch (TUBE_ANODES[tubeIndex]) {
+      case 1:
+        tubeAnodePorts[tubeIndex] = R_PORT1;
+        tubeAnodeBits[tubeIndex] = PIN_ANODE_1_DPM_BIT;
+        break;
+      case 2:
+        tubeAnodePorts[tubeIndex] = R_PORT4;
+        tubeAnodeBits[tubeIndex] = PIN_ANODE_2_DPM_BIT;
+        break;
+      case 3:
+        tubeAnodePorts[tubeIndex] = R_PORT4;
+        tubeAnodeBits[tubeIndex] = PIN_ANODE_3_DPM_BIT;
+        break;
     }
   }
+}
+
+inline void displayOnTube(byte tubeIndex, byte displayVal) {
+  // also covers BLANK
+  if (displayVal >= DIGITS_PER_TUBE) {
+    return;
+  }
+
+  const TubePortMasks& masks = tubePortMasks[tubeIndex][displayVal];
+
+  R_PORT1->PCNTR3 = masks.port1Cntr3;
+  R_PORT3->PCNTR3 = masks.port3Cntr3;
 
   delayMicroseconds(HV_STABILIZATION_DELAY_US);
 
   // set high anode pin
-  switch (anode) {
-    case 1:
-      R_PORT1->POSR = PIN_ANODE_1_DPM_BIT;
-      break;
-    case 2:
-      R_PORT4->POSR = PIN_ANODE_2_DPM_BIT;
-      break;
-    case 3:
-      R_PORT4->POSR = PIN_ANODE_3_DPM_BIT;
-      break;
-  }
+  tubeAnodePorts[tubeIndex]->POSR = tubeAnodeBits[tubeIndex];
+}
+
+#endif
+
+/*
+ * ============================================================================
+ * CPU Cycle Counter (CLOCK_BENCHMARK only, see clock-benchmark.h)
+ * ============================================================================
+ */
+#if defined(CLOCK_BENCHMARK)
+
+#if defined(CLOCK_HOST_SIM)
+
+// time stamp counter on x86 hosts (close to, but not exactly, core cycles)
+typedef uint64_t CycleCount;
+
+inline void setupCycleCounter() {}
+
+inline CycleCount readCycleCounter() {
+  return simCycleCounter();
+}
+
+inline void haltAfterBenchmarks() {
+  exit(0);
+}
+
+#elif defined(ARDUINO_AVR_UNO)
+
+#if defined(MULTIPLEX_USE_TIMER_ISR)
+  #error "CLOCK_BENCHMARK uses Timer1 as its cycle counter, and can't be combined with MULTIPLEX_USE_TIMER_ISR"
+#endif
+
+#include <avr/sleep.h>
+
+// Timer1 free-running at the CPU clock (no prescaler), so a single measured
+// call must stay under 65536 cycles (~4ms)
+typedef uint16_t CycleCount;
+
+inline void setupCycleCounter() {
+  TCCR1A = 0;
+  TCCR1B = (1 << CS10);
+  TCNT1 = 0;
+}
+
+inline CycleCount readCycleCounter() {
+  return TCNT1;
+}
+
+// simavr exits when the CPU sleeps with interrupts disabled
+inline void haltAfterBenchmarks() {
+  Serial.flush();
+  cli();
+  sleep_enable();
+  sleep_cpu();
+}
+
+#elif defined(ARDUINO_UNOWIFIR4)
+
+// Cortex-M4 DWT cycle counter
+typedef uint32_t CycleCount;
+
+inline void setupCycleCounter() {
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CYCCNT = 0;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
 }
 
+inline CycleCount readCycleCounter() {
+  return DWT->CYCCNT;
+}
+
+inline void haltAfterBenchmarks() {
+  Serial.flush();
+  while (true) {}
+}
+
+#endif
+
 #endif
 
 /*
@@ -409,6 +588,19 @@ inline void displayOnTube(byte tubeIndex, byte displayVal) {
  * Common
  * ============================================================================
  */
+// The state handlers call this on every loop, but the ports are only written
+// when an LED actually changes.
+byte buttonLEDsShown = 0xFF; // nothing written yet
+
+inline void setButtonLEDs(bool leftOn, bool rightOn) {
+  byte leds = (leftOn ? 1 : 0) | (rightOn ? 2 : 0);
+
+  if (leds != buttonLEDsShown) {
+    buttonLEDsShown = leds;
+    writeButtonLEDs(leftOn, rightOn);
+  }
+}
+
 inline void setupCommon() {
   // arduinix tube controller pins
   pinMode(PIN_ANODE_1, OUTPUT);
@@ -444,6 +636,132 @@ inline void setupCommon() {
   Serial.begin(SERIAL_SPEED_BAUD);
 }
 
+/*
+ * ============================================================================
+ * Button Edge Capture (BUTTON_CAPTURE_INTERRUPTS only)
+ *
+ * Every change on a button pin pushes a snapshot of all three buttons, along
+ * with the micros() it happened at, into a single-producer/single-consumer
+ * ring: the interrupt handler only ever writes the head, and loop() only ever
+ * writes the tail, so neither side needs to mask interrupts.
+ *
+ * If loop() falls far enough behind for the ring to fill up, the newest entry
+ * is overwritten instead, so only intermediate bounces are lost and the last
+ * state seen is always the one that gets debounced.
+ * Those are counted, and reported in the instrumentation dump (see
+ * printHardwareCounters()).
+ * ============================================================================
+ */
+#if defined(BUTTON_CAPTURE_INTERRUPTS)
+
+const byte BUTTON_EDGE_LEFT = 1 << 0;
+const byte BUTTON_EDGE_RIGHT = 1 << 1;
+const byte BUTTON_EDGE_UTILITY = 1 << 2;
+
+// power of 2, so the free-running head & tail can be masked into an index
+const byte BUTTON_EDGE_QUEUE_CAPACITY = 16;
+const byte BUTTON_EDGE_QUEUE_MASK = BUTTON_EDGE_QUEUE_CAPACITY - 1;
+
+typedef struct {
+  unsigned long timestampUS;
+  byte values; // BUTTON_EDGE_* bits, set while a button reads HIGH (released)
+} ButtonEdge;
+
+ButtonEdge buttonEdgeQueue[BUTTON_EDGE_QUEUE_CAPACITY];
+volatile byte buttonEdgeQueueHead = 0;
+volatile byte buttonEdgeQueueTail = 0;
+volatile unsigned int buttonEdgesCoalesced = 0;
+
+inline byte packButtonValues(ButtonValues vals) {
+  return (vals.left ? BUTTON_EDGE_LEFT : 0)
+    | (vals.right ? BUTTON_EDGE_RIGHT : 0)
+    | (vals.utility ? BUTTON_EDGE_UTILITY : 0);
+}
+
+// producer: called from the pin change interrupt handler
+inline void captureButtonEdge() {
+  unsigned long now = micros();
+  byte values = packButtonValues(readButtonValues());
+  byte head = buttonEdgeQueueHead;
+
+  if ((byte)(head - buttonEdgeQueueTail) >= BUTTON_EDGE_QUEUE_CAPACITY) {
+    ButtonEdge& newest = buttonEdgeQueue[(byte)(head - 1) & BUTTON_EDGE_QUEUE_MASK];
+    newest.timestampUS = now;
+    newest.values = values;
+    buttonEdgesCoalesced++;
+    return;
+  }
+
+  ButtonEdge& edge = buttonEdgeQueue[head & BUTTON_EDGE_QUEUE_MASK];
+  edge.timestampUS = now;
+  edge.values = values;
+  buttonEdgeQueueHead = head + 1;
+}
+
+// consumer: called from loop()
+inline bool popButtonEdge(ButtonEdge& edge) {
+  byte tail = buttonEdgeQueueTail;
+  if (tail == buttonEdgeQueueHead) {
+    return false;
+  }
+
+  edge = buttonEdgeQueue[tail & BUTTON_EDGE_QUEUE_MASK];
+  buttonEdgeQueueTail = tail + 1;
+  return true;
+}
+
+#if defined(ARDUINO_AVR_UNO)
+
+// A0, A1 & A4 are PCINT8, PCINT9 & PCINT12, all in pin change group 1 (PORTC)
+ISR(PCINT1_vect) {
+  captureButtonEdge();
+}
+
+inline void setupButtonCapture() {
+  PCMSK1 |= (1 << PCINT8) | (1 << PCINT9) | (1 << PCINT12);
+  PCICR |= (1 << PCIE1);
+}
+
+#elif defined(ARDUINO_UNOWIFIR4)
+
+// each button pin gets its own IRQ; any that can't (attachInterrupt() quietly
+// ignores those) still get picked up by the loop's own reading of the pins
+inline void setupButtonCapture() {
+  attachInterrupt(digitalPinToInterrupt(PIN_BUTTON_RIGHT), captureButtonEdge, CHANGE);
+  attachInterrupt(digitalPinToInterrupt(PIN_BUTTON_LEFT), captureButtonEdge, CHANGE);
+  attachInterrupt(digitalPinToInterrupt(PIN_BUTTON_UTILITY), captureButtonEdge, CHANGE);
+}
+
+#else
+
+// host simulation: sim/clock-sim.cpp calls captureButtonEdge() itself whenever
+// a scripted button changes
+inline void setupButtonCapture() {}
+
+#endif
+
+#endif
+
+// Counts of events merged or lost on the way in or out, for the INSTR
+// counters line (see clock-instrumentation.h), each as ",<name>=<count>"
+inline void printHardwareCounters() {
+  #if defined(BUTTON_CAPTURE_INTERRUPTS)
+    // (written by the button ISRs)
+    noInterrupts();
+    unsigned int edgesCoalesced = buttonEdgesCoalesced;
+    interrupts();
+
+    Serial.print(F(",button-edges-coalesced="));
+    Serial.print(edgesCoalesced);
+  #endif
+
+  #if defined(ARDUINO_UNOWIFIR4)
+    // outbox full, or the ntfy server couldn't be reached (see clock-wifi.h)
+    Serial.print(F(",notifications-dropped="));
+    Serial.print(notificationsDropped);
+  #endif
+}
+
 /*
  * ============================================================================
  * Entrypoints to hardware-specific code
@@ -453,18 +771,23 @@ inline void setupHardware() {
   setupCommon();
 
   #if defined(ARDUINO_AVR_UNO)
-    Serial.println("Arduino Uno R1-R3 (AVR-based) Detected!");
+    Serial.println(F("Arduino Uno R1-R3 (AVR-based) Detected!"));
 
   #elif defined(ARDUINO_UNOWIFIR4)
-    Serial.println("Arduino Uno R4 WiFi (Renesas-based) Detected!");
-    setButtonLEDs(true, true);
+    Serial.println(F("Arduino Uno R4 WiFi (Renesas-based) Detected!"));
+    setupTubePortMasks();
     setupWifi();
-    delay(500);
-    setButtonLEDs(false, false);
+
+  #elif defined(CLOCK_HOST_SIM)
+    Serial.println(F("Host Simulation (virtual Uno R1-R3 ports) Detected!"));
 
   #endif
 
-  Serial.println("Setup complete!");
+  #if defined(BUTTON_CAPTURE_INTERRUPTS)
+    setupButtonCapture();
+  #endif
+
+  Serial.println(F("Setup complete!"));
 }
 
 inline void loopHardware(unsigned long loopNow) {
@@ -472,8 +795,23 @@ inline void loopHardware(unsigned long loopNow) {
     // this may eventually be something like communication with an RTC chip
 
   #elif defined(ARDUINO_UNOWIFIR4)
-    // wifi reconnecting is handled automatically by the ESP32-S3
+    loopWifi(loopNow);
+    loopNotificationOutbox(loopNow);
+
+  #elif defined(CLOCK_HOST_SIM)
+    // nothing to do: time, buttons and serial are driven by sim/clock-sim.cpp
+
+  #endif
+}
 
+// what the button LEDs should show while the clock is idle: normally off, but
+// on the Uno R4 WiFi, the WiFi link's progress until it's up
+inline void idleButtonLEDs(unsigned long loopNow, bool& left, bool& right) {
+  #if defined(ARDUINO_UNOWIFIR4)
+    wifiStatusLEDs(loopNow, left, right);
+  #else
+    left = false;
+    right = false;
   #endif
 }
 
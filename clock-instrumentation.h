@@ -0,0 +1,238 @@
+/*
+ * ============================================================================
+ * Main Loop Instrumentation (CLOCK_INSTRUMENTATION)
+ *
+ * Times each phase of loop() and every lit tube slot, collecting min/max and
+ * a fixed-size log2 histogram per measurement. Sending an 'I' over Serial
+ * prints the histograms (one line per measurement, prefixed with INSTR) at the
+ * end of that loop, then starts a fresh measurement window, so that neither
+ * the command nor the printing shows up in the measurements. (A button would
+ * change the clock's state, e.g. end a game, so measuring during play would be
+ * impossible.)
+ *
+ * After the histograms, one more line gives counts of events that were merged
+ * or lost along the way (see printHardwareCounters()):
+ *
+ *   INSTR,counters,<name>=<count>,...
+ *
+ * When CLOCK_INSTRUMENTATION isn't defined, all of the hooks compile away.
+ * ============================================================================
+ */
+
+#ifndef _CLOCK_INSTRUMENTATION_H
+#define _CLOCK_INSTRUMENTATION_H
+
+#include "clock-config.h"
+#include "clock-serial-out.h"
+#include "clock-hardware.h"
+
+enum LatencyPhase {
+  PHASE_BUTTONS,
+  PHASE_STATE,
+  PHASE_IO,
+  PHASE_SLEEP,
+  PHASE_MULTIPLEX,
+  PHASE_HARDWARE,
+  PHASE_LOOP,
+  PHASE_TUBE_LIT,
+  LATENCY_PHASE_COUNT
+};
+
+#if defined(CLOCK_INSTRUMENTATION)
+
+// bin 0 counts 0us, bin n counts [2^(n-1), 2^n) us, the last bin counts everything longer
+const byte LATENCY_HISTOGRAM_BINS = 16;
+
+// in flash, like the option labels (see clock-data-types.h)
+const byte LATENCY_PHASE_LABEL_SIZE = 10;
+const char LATENCY_PHASE_LABELS[LATENCY_PHASE_COUNT][LATENCY_PHASE_LABEL_SIZE] PROGMEM = {
+  "buttons", "state", "io", "sleep", "multiplex", "hardware", "loop", "tube-lit"
+};
+
+typedef struct {
+  unsigned int counts[LATENCY_HISTOGRAM_BINS];
+  unsigned long minUS;
+  unsigned long maxUS;
+  unsigned long samples;
+} LatencyHistogram;
+
+LatencyHistogram latencyHistograms[LATENCY_PHASE_COUNT];
+unsigned long instrumentLoopStartUS = 0UL;
+unsigned long instrumentLapUS = 0UL;
+volatile unsigned long instrumentTubeLitUS = 0UL;
+bool instrumentationDumpRequested = false;
+
+// (the multiplexer's timer ISR may be recording a tube-lit time)
+inline void resetLatencyHistograms() {
+  noInterrupts();
+  memset(latencyHistograms, 0, sizeof(latencyHistograms));
+
+  for (byte p = 0; p < LATENCY_PHASE_COUNT; p++) {
+    latencyHistograms[p].minUS = 0xFFFFFFFFUL;
+  }
+  interrupts();
+}
+
+inline void recordLatency(LatencyPhase phase, unsigned long durationUS) {
+  LatencyHistogram& h = latencyHistograms[phase];
+
+  byte bin = 0;
+  while (bin < LATENCY_HISTOGRAM_BINS - 1 && (durationUS >> bin)) {
+    bin++;
+  }
+
+  // keep the bins' proportions (which is all percentiles need) rather than overflow
+  if (h.counts[bin] == 0xFFFF) {
+    for (byte i = 0; i < LATENCY_HISTOGRAM_BINS; i++) {
+      h.counts[i] >>= 1;
+    }
+  }
+
+  h.counts[bin]++;
+  h.samples++;
+
+  if (durationUS < h.minUS) {
+    h.minUS = durationUS;
+  }
+  if (durationUS > h.maxUS) {
+    h.maxUS = durationUS;
+  }
+}
+
+// upper bound (exclusive, in us) of the bin holding the given percentile
+inline unsigned long latencyPercentileUS(const LatencyHistogram& h, byte percentile) {
+  unsigned long total = 0;
+  for (byte i = 0; i < LATENCY_HISTOGRAM_BINS; i++) {
+    total += h.counts[i];
+  }
+
+  unsigned long target = (total * percentile + 99) / 100;
+  unsigned long cumulative = 0;
+  for (byte i = 0; i < LATENCY_HISTOGRAM_BINS; i++) {
+    cumulative += h.counts[i];
+    if (cumulative >= target) {
+      return 1UL << i;
+    }
+  }
+
+  return 1UL << (LATENCY_HISTOGRAM_BINS - 1);
+}
+
+// The dump goes straight to Serial, like dumpMoveLog(): with
+// SERIAL_TX_SCHEDULER, a status or notification message may be partly sent,
+// so it's finished first rather than split by the INSTR lines.
+inline void dumpLatencyHistograms(unsigned int tubeLitTargetUS) {
+  serialFinishMessage();
+
+  for (byte p = 0; p < LATENCY_PHASE_COUNT; p++) {
+    const LatencyHistogram& h = latencyHistograms[p];
+
+    Serial.print(F("INSTR,"));
+    const char* label = LATENCY_PHASE_LABELS[p];
+    char c;
+    while ((c = pgm_read_byte(label++))) {
+      Serial.write((byte)c);
+    }
+    Serial.print(F(",n="));
+    Serial.print(h.samples);
+
+    if (h.samples > 0) {
+      Serial.print(F(",min="));
+      Serial.print(h.minUS);
+      Serial.print(F(",p50<"));
+      Serial.print(latencyPercentileUS(h, 50));
+      Serial.print(F(",p90<"));
+      Serial.print(latencyPercentileUS(h, 90));
+      Serial.print(F(",p99<"));
+      Serial.print(latencyPercentileUS(h, 99));
+      Serial.print(F(",max="));
+      Serial.print(h.maxUS);
+    }
+
+    if (p == PHASE_TUBE_LIT) {
+      Serial.print(F(",target="));
+      Serial.print(tubeLitTargetUS);
+    }
+
+    Serial.print(F(",bins="));
+    for (byte i = 0; i < LATENCY_HISTOGRAM_BINS; i++) {
+      if (i > 0) {
+        Serial.print(F(" "));
+      }
+      Serial.print(h.counts[i]);
+    }
+    Serial.println();
+  }
+
+  Serial.print(F("INSTR,counters"));
+  printHardwareCounters();
+  Serial.println();
+}
+
+inline void instrumentLoopStart() {
+  instrumentLoopStartUS = instrumentLapUS = micros();
+}
+
+// record the time since the previous lap (or loop start) against the given phase
+inline void instrumentLap(LatencyPhase phase) {
+  unsigned long now = micros();
+  recordLatency(phase, now - instrumentLapUS);
+  instrumentLapUS = now;
+}
+
+// like instrumentLap(), for time spent asleep, which isn't counted in the
+// loop's own total
+inline void instrumentSleepLap(LatencyPhase phase) {
+  unsigned long now = micros();
+  recordLatency(phase, now - instrumentLapUS);
+  instrumentLoopStartUS += now - instrumentLapUS;
+  instrumentLapUS = now;
+}
+
+inline void instrumentLoopEnd() {
+  recordLatency(PHASE_LOOP, micros() - instrumentLoopStartUS);
+}
+
+// called by the multiplexer (possibly from its timer ISR) as a tube is lit / blanked
+inline void instrumentTubeLit() {
+  instrumentTubeLitUS = micros();
+}
+
+inline void instrumentTubeBlanked() {
+  recordLatency(PHASE_TUBE_LIT, micros() - instrumentTubeLitUS);
+}
+
+inline void setupInstrumentation() {
+  resetLatencyHistograms();
+}
+
+// called with an 'I' from Serial (see loopSerialCommands())
+inline void requestInstrumentationDump() {
+  instrumentationDumpRequested = true;
+}
+
+// called after instrumentLoopEnd(), so the next window starts with the next loop
+inline void loopInstrumentation(unsigned int tubeLitTargetUS) {
+  if (!instrumentationDumpRequested) {
+    return;
+  }
+
+  instrumentationDumpRequested = false;
+  dumpLatencyHistograms(tubeLitTargetUS);
+  resetLatencyHistograms();
+}
+
+#else
+
+inline void instrumentLoopStart() {}
+inline void instrumentLap(LatencyPhase phase) {}
+inline void instrumentSleepLap(LatencyPhase phase) {}
+inline void instrumentLoopEnd() {}
+inline void instrumentTubeLit() {}
+inline void instrumentTubeBlanked() {}
+inline void setupInstrumentation() {}
+inline void loopInstrumentation(unsigned int tubeLitTargetUS) {}
+
+#endif
+
+#endif _CLOCK_INSTRUMENTATION_H
@@ -0,0 +1,313 @@
+/*
+ * ============================================================================
+ * Game Journal (CLOCK_GAME_JOURNAL)
+ *
+ * Keeps the game in progress in EEPROM (the Uno R4 WiFi's is emulated in its
+ * data flash), so that it picks up where it left off after a power cut
+ * rather than losing e.g. a 72h correspondence turn.
+ *
+ * The journal is append-only: each time a turn starts, or a game ends, a
+ * JOURNAL_RECORD_SIZE byte record goes into the next slot, wrapping around
+ * the whole EEPROM, so each byte is only rewritten once every 50-odd turns
+ * (hundreds, on the R4). At boot, every slot is read, and the valid record
+ * (by checksum) with the highest sequence number is the latest:
+ *
+ *   u16 sequence | u8 flags | u8 menu option | u32 RTC seconds at turn start |
+ *   u32 left bank ms | u32 right bank ms | u8 left stage moves |
+ *   u8 right stage moves | CRC-8
+ *
+ *   flags: bits 0-2 ClockState, bit 3 left player's turn, bits 4 & 5 the left
+ *   & right players' time control stage
+ *
+ * Records are written a byte per loop(), and only once the previous byte has
+ * finished (an EEPROM byte takes ~3.4ms to write on the Uno), so writing
+ * never holds up the multiplexer. On the R4, each byte goes through the
+ * core's EEPROM emulation, which is slower, so use MULTIPLEX_USE_TIMER_ISR
+ * there. The sequence number is written last, so a record cut short by a
+ * power cut can never pass for the latest one. If a new record comes along
+ * before the last one is finished, it replaces it.
+ *
+ * Time spent powered off comes from the R4's real-time clock, if it kept
+ * running through the power cut (with a battery on VRTC). Otherwise (and
+ * always on the Uno, where the I2C pins are taken by buttons), there's no
+ * telling how far into the turn the power went, so the turn starts over.
+ * ============================================================================
+ */
+
+#ifndef _CLOCK_JOURNAL_H
+#define _CLOCK_JOURNAL_H
+
+#include "clock-config.h"
+#include "clock-data-types.h"
+
+#if defined(CLOCK_GAME_JOURNAL)
+
+#if defined(ARDUINO_AVR_UNO)
+  #include <avr/eeprom.h>
+#elif defined(ARDUINO_UNOWIFIR4)
+  #include <EEPROM.h>
+  #include <RTC.h>
+#endif
+
+const byte JOURNAL_RECORD_SIZE = 19;
+const byte JOURNAL_SEQUENCE_SIZE = 2;
+const uint16_t JOURNAL_SEQUENCE_ERASED = 0xFFFF; // never written, so blank EEPROM never counts
+
+const byte JOURNAL_FLAGS_STATE_MASK = 0x07;
+const byte JOURNAL_FLAG_LEFT_PLAYERS_TURN = 1 << 3;
+const byte JOURNAL_FLAG_LEFT_STAGE = 1 << 4;
+const byte JOURNAL_FLAG_RIGHT_STAGE = 1 << 5;
+
+// a fixed starting point for an RTC that wasn't already running: only the
+// differences between its readings matter (2024-01-01 00:00:00 UTC)
+const unsigned long JOURNAL_RTC_START_SECONDS = 1704067200UL;
+
+static_assert(CLOCK_STATE_COUNT <= JOURNAL_FLAGS_STATE_MASK + 1, "journal flags have 3 bits for the ClockState");
+static_assert(TIME_CONTROL_MAX_STAGES <= 2, "journal flags have 1 bit for each player's stage");
+
+typedef struct {
+  ClockState state;
+  bool leftPlayersTurn;
+  byte turnTimerOption;
+  unsigned long turnStartRTCSeconds;  // 0 if there's no RTC
+  PlayerBank leftBank;
+  PlayerBank rightBank;
+} JournalEntry;
+
+uint16_t journalSequence = JOURNAL_SEQUENCE_ERASED;  // of the latest record written
+unsigned int journalNextSlot = 0;
+bool journalRTCKeptTime = false;                     // through the last power cut
+unsigned long journalTurnStartRTCSeconds = 0UL;
+
+byte journalPendingRecord[JOURNAL_RECORD_SIZE];
+bool journalWriting = false;
+byte journalWriteIndex = 0;  // into JOURNAL_WRITE_ORDER
+
+/*
+ * Storage: the Uno's EEPROM (and a model of it in the host simulation), or the
+ * R4's emulated EEPROM
+ */
+#if defined(ARDUINO_AVR_UNO) || defined(CLOCK_HOST_SIM)
+
+inline unsigned int journalSlotCount() {
+  return (E2END + 1) / JOURNAL_RECORD_SIZE;
+}
+
+inline bool journalStorageReady() {
+  return eeprom_is_ready();
+}
+
+inline byte readJournalByte(unsigned int address) {
+  return eeprom_read_byte((const uint8_t*)(uintptr_t)address);
+}
+
+// starts the write, and returns straight away (see journalStorageReady())
+inline void writeJournalByte(unsigned int address, byte value) {
+  if (eeprom_read_byte((const uint8_t*)(uintptr_t)address) != value) {
+    eeprom_write_byte((uint8_t*)(uintptr_t)address, value);
+  }
+}
+
+#elif defined(ARDUINO_UNOWIFIR4)
+
+inline unsigned int journalSlotCount() {
+  return EEPROM.length() / JOURNAL_RECORD_SIZE;
+}
+
+inline bool journalStorageReady() {
+  return true;
+}
+
+inline byte readJournalByte(unsigned int address) {
+  return EEPROM.read(address);
+}
+
+inline void writeJournalByte(unsigned int address, byte value) {
+  EEPROM.update(address, value);
+}
+
+#endif
+
+/*
+ * RTC: the R4's (also modelled in the host simulation)
+ */
+#if defined(ARDUINO_UNOWIFIR4) || defined(CLOCK_HOST_SIM)
+
+inline void setupJournalRTC() {
+  RTC.begin();
+
+  // still running from before: it has a battery, and kept time while we were off
+  journalRTCKeptTime = RTC.isRunning();
+  if (!journalRTCKeptTime) {
+    RTCTime start(JOURNAL_RTC_START_SECONDS);
+    RTC.setTime(start);
+  }
+}
+
+inline unsigned long journalRTCSeconds() {
+  RTCTime now;
+  RTC.getTime(now);
+  return now.getUnixTime();
+}
+
+#else
+
+inline void setupJournalRTC() {}
+
+inline unsigned long journalRTCSeconds() {
+  return 0UL;
+}
+
+#endif
+
+// CRC-8 (polynomial 0x07), a bit at a time: only run for a record at a time
+inline byte journalCrc8(const byte* bytes, byte length) {
+  byte crc = 0;
+
+  for (byte i = 0; i < length; i++) {
+    crc ^= bytes[i];
+    for (byte bit = 0; bit < 8; bit++) {
+      crc = crc & 0x80 ? (crc << 1) ^ 0x07 : crc << 1;
+    }
+  }
+
+  return crc;
+}
+
+inline void putJournalU32(byte* record, unsigned long value) {
+  record[0] = value;
+  record[1] = value >> 8;
+  record[2] = value >> 16;
+  record[3] = value >> 24;
+}
+
+inline unsigned long getJournalU32(const byte* record) {
+  return (unsigned long)record[0]
+    | (unsigned long)record[1] << 8
+    | (unsigned long)record[2] << 16
+    | (unsigned long)record[3] << 24;
+}
+
+inline uint16_t journalRecordSequence(const byte* record) {
+  return record[0] | record[1] << 8;
+}
+
+inline void encodeJournalRecord(const JournalEntry& entry, uint16_t sequence, byte* record) {
+  record[0] = sequence;
+  record[1] = sequence >> 8;
+  record[2] = entry.state
+    | (entry.leftPlayersTurn ? JOURNAL_FLAG_LEFT_PLAYERS_TURN : 0)
+    | (entry.leftBank.stage ? JOURNAL_FLAG_LEFT_STAGE : 0)
+    | (entry.rightBank.stage ? JOURNAL_FLAG_RIGHT_STAGE : 0);
+  record[3] = entry.turnTimerOption;
+  putJournalU32(&record[4], entry.turnStartRTCSeconds);
+  putJournalU32(&record[8], entry.leftBank.bankMS);
+  putJournalU32(&record[12], entry.rightBank.bankMS);
+  record[16] = entry.leftBank.stageMoves;
+  record[17] = entry.rightBank.stageMoves;
+  record[18] = journalCrc8(record, JOURNAL_RECORD_SIZE - 1);
+}
+
+inline void decodeJournalRecord(const byte* record, JournalEntry& entry) {
+  entry.state = (ClockState)(record[2] & JOURNAL_FLAGS_STATE_MASK);
+  entry.leftPlayersTurn = record[2] & JOURNAL_FLAG_LEFT_PLAYERS_TURN;
+  entry.turnTimerOption = record[3];
+  entry.turnStartRTCSeconds = getJournalU32(&record[4]);
+
+  entry.leftBank = PlayerBank();
+  entry.leftBank.bankMS = getJournalU32(&record[8]);
+  entry.leftBank.stage = record[2] & JOURNAL_FLAG_LEFT_STAGE ? 1 : 0;
+  entry.leftBank.stageMoves = record[16];
+
+  entry.rightBank = PlayerBank();
+  entry.rightBank.bankMS = getJournalU32(&record[12]);
+  entry.rightBank.stage = record[2] & JOURNAL_FLAG_RIGHT_STAGE ? 1 : 0;
+  entry.rightBank.stageMoves = record[17];
+}
+
+inline bool journalRecordValid(const byte* record) {
+  return journalRecordSequence(record) != JOURNAL_SEQUENCE_ERASED
+    && journalCrc8(record, JOURNAL_RECORD_SIZE - 1) == record[JOURNAL_RECORD_SIZE - 1];
+}
+
+// Finds the latest record, and where the next one goes. Returns false if
+// there's no valid record at all (e.g. the first boot).
+inline bool loadJournal(JournalEntry& entry) {
+  setupJournalRTC();
+
+  byte record[JOURNAL_RECORD_SIZE];
+  unsigned int slots = journalSlotCount();
+  bool found = false;
+
+  for (unsigned int slot = 0; slot < slots; slot++) {
+    for (byte i = 0; i < JOURNAL_RECORD_SIZE; i++) {
+      record[i] = readJournalByte(slot * JOURNAL_RECORD_SIZE + i);
+    }
+
+    if (!journalRecordValid(record)) {
+      continue;
+    }
+
+    // sequence numbers wrap, but every valid record is within a lap of the
+    // slots of the latest one
+    uint16_t sequence = journalRecordSequence(record);
+    if (!found || (int16_t)(sequence - journalSequence) > 0) {
+      found = true;
+      journalSequence = sequence;
+      journalNextSlot = slot + 1 < slots ? slot + 1 : 0;
+      decodeJournalRecord(record, entry);
+    }
+  }
+
+  return found;
+}
+
+// Queues a record, replacing any that hasn't finished being written.
+inline void appendJournal(const JournalEntry& entry) {
+  uint16_t sequence = journalSequence + 1;
+  if (sequence == JOURNAL_SEQUENCE_ERASED) {
+    sequence++;
+  }
+
+  encodeJournalRecord(entry, sequence, journalPendingRecord);
+  journalWriting = true;
+  journalWriteIndex = 0;
+}
+
+inline bool journalWritePending() {
+  return journalWriting;
+}
+
+// the sequence number (bytes 0 & 1) goes last
+inline byte journalWriteOffset(byte index) {
+  return index < JOURNAL_RECORD_SIZE - JOURNAL_SEQUENCE_SIZE
+    ? index + JOURNAL_SEQUENCE_SIZE
+    : index - (JOURNAL_RECORD_SIZE - JOURNAL_SEQUENCE_SIZE);
+}
+
+inline void loopJournal() {
+  if (!journalWriting || !journalStorageReady()) {
+    return;
+  }
+
+  byte offset = journalWriteOffset(journalWriteIndex);
+  writeJournalByte(journalNextSlot * JOURNAL_RECORD_SIZE + offset, journalPendingRecord[offset]);
+
+  if (++journalWriteIndex == JOURNAL_RECORD_SIZE) {
+    journalWriting = false;
+    journalSequence = journalRecordSequence(journalPendingRecord);
+    journalNextSlot = journalNextSlot + 1 < journalSlotCount() ? journalNextSlot + 1 : 0;
+  }
+}
+
+#else
+
+inline bool journalWritePending() {
+  return false;
+}
+
+inline void loopJournal() {}
+
+#endif
+
+#endif _CLOCK_JOURNAL_H
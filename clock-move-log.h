@@ -0,0 +1,163 @@
+/*
+ * ============================================================================
+ * Move Log (CLOCK_MOVE_LOG)
+ *
+ * Records the time taken by each move of the current game, in centiseconds,
+ * in a fixed RAM ring. Each move is stored as the difference from the move
+ * before it, zigzag-encoded (so small negative differences stay small) and
+ * written as a little-endian base-128 varint. Consecutive moves usually take
+ * similar times, so most moves cost 1 or 2 bytes, and the ring holds 200-380
+ * moves. Once it's full, the oldest moves are dropped to make room, each one
+ * folded into the base value that the remaining differences count from.
+ *
+ * logMove() is called on the turn-change path: it only ever encodes one value
+ * and drops at most a few old ones, with no allocation.
+ *
+ * dumpMoveLog() streams the whole log as one line, oldest move first:
+ *
+ *   CCMOVES,<label>,<first move number>,<L|R, who made it>,<cs>,<cs>,...
+ *
+ * When CLOCK_MOVE_LOG isn't defined, resetMoveLog() & logMove() compile away.
+ * ============================================================================
+ */
+
+#ifndef _CLOCK_MOVE_LOG_H
+#define _CLOCK_MOVE_LOG_H
+
+#include "clock-config.h"
+#include "clock-serial-out.h"
+#include "clock-strings.h"
+
+#if defined(CLOCK_MOVE_LOG)
+
+const unsigned int MOVE_LOG_CAPACITY_BYTES = 384;
+const byte MOVE_LOG_MAX_VARINT_BYTES = 5; // 32 bits, 7 at a time
+
+byte moveLog[MOVE_LOG_CAPACITY_BYTES];
+unsigned int moveLogHead = 0;       // where the next move is written
+unsigned int moveLogUsedBytes = 0;
+unsigned int moveLogCount = 0;      // moves in the ring
+unsigned int moveLogFirstMove = 1;  // the number of the oldest move in the ring
+unsigned long moveLogBaseCS = 0UL;  // the move before the oldest one
+unsigned long moveLogLastCS = 0UL;  // the newest move
+bool moveLogFirstMoverLeft = false; // who made move 1
+const char* moveLogLabel = NO_LABEL; // a flash string, see clock-data-types.h
+
+inline unsigned int moveLogTail() {
+  return moveLogHead >= moveLogUsedBytes
+    ? moveLogHead - moveLogUsedBytes
+    : moveLogHead + MOVE_LOG_CAPACITY_BYTES - moveLogUsedBytes;
+}
+
+// reads one varint, advancing `index` (around the ring) past it
+inline unsigned long readMoveLogVarint(unsigned int& index, byte& length) {
+  unsigned long value = 0UL;
+  byte shift = 0;
+  byte b;
+  length = 0;
+
+  do {
+    b = moveLog[index];
+    if (++index == MOVE_LOG_CAPACITY_BYTES) {
+      index = 0;
+    }
+
+    value |= (unsigned long)(b & 0x7F) << shift;
+    shift += 7;
+    length++;
+  } while (b & 0x80);
+
+  return value;
+}
+
+inline long unzigzag(unsigned long value) {
+  return (long)(value >> 1) ^ -(long)(value & 1);
+}
+
+inline unsigned long zigzag(long value) {
+  return ((unsigned long)value << 1) ^ (unsigned long)(value >> 31);
+}
+
+inline void dropOldestMove() {
+  unsigned int tail = moveLogTail();
+  byte length;
+
+  moveLogBaseCS += unzigzag(readMoveLogVarint(tail, length));
+  moveLogUsedBytes -= length;
+  moveLogCount--;
+  moveLogFirstMove++;
+}
+
+inline void resetMoveLog(bool leftPlayerStarts, const char* label) {
+  moveLogHead = 0;
+  moveLogUsedBytes = 0;
+  moveLogCount = 0;
+  moveLogFirstMove = 1;
+  moveLogBaseCS = 0UL;
+  moveLogLastCS = 0UL;
+  moveLogFirstMoverLeft = leftPlayerStarts;
+  moveLogLabel = label;
+}
+
+inline void logMove(unsigned long moveMS) {
+  unsigned long moveCS = moveMS / 10;
+  unsigned long value = zigzag((long)(moveCS - moveLogLastCS));
+
+  byte encoded[MOVE_LOG_MAX_VARINT_BYTES];
+  byte length = 0;
+  while (value >= 0x80) {
+    encoded[length++] = (value & 0x7F) | 0x80;
+    value >>= 7;
+  }
+  encoded[length++] = value;
+
+  while (MOVE_LOG_CAPACITY_BYTES - moveLogUsedBytes < length) {
+    dropOldestMove();
+  }
+
+  for (byte i = 0; i < length; i++) {
+    moveLog[moveLogHead] = encoded[i];
+    if (++moveLogHead == MOVE_LOG_CAPACITY_BYTES) {
+      moveLogHead = 0;
+    }
+  }
+
+  moveLogUsedBytes += length;
+  moveLogCount++;
+  moveLogLastCS = moveCS;
+}
+
+inline void dumpMoveLog() {
+  // moves alternate, so who made the oldest one follows from its number
+  bool oldestByLeft = moveLogFirstMoverLeft != ((moveLogFirstMove - 1) & 1);
+
+  serialFinishMessage();
+  Serial.print(F("CCMOVES,"));
+  for (const char* c = moveLogLabel; pgm_read_byte(c); c++) {
+    Serial.write(pgm_read_byte(c));
+  }
+  Serial.print(",");
+  Serial.print(moveLogFirstMove);
+  Serial.print(oldestByLeft ? ",L" : ",R");
+
+  unsigned int index = moveLogTail();
+  unsigned long moveCS = moveLogBaseCS;
+  byte length;
+
+  for (unsigned int i = 0; i < moveLogCount; i++) {
+    moveCS += unzigzag(readMoveLogVarint(index, length));
+    Serial.print(",");
+    Serial.print(moveCS);
+  }
+
+  Serial.println();
+}
+
+#else
+
+inline void resetMoveLog(bool leftPlayerStarts, const char* label) {}
+inline void logMove(unsigned long moveMS) {}
+
+#endif
+
+#endif _CLOCK_MOVE_LOG_H
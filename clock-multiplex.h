@@ -0,0 +1,278 @@
+/*
+ * ============================================================================
+ * Nixie Tube Multiplexing
+ *
+ * Only one tube is lit at any moment. Lighting each tube in turn, quickly
+ * enough, makes the whole display appear lit. State handlers write the digits
+ * they want shown to multiplexDisplayValues[], and the multiplexer steps
+ * through the tubes either:
+ *  - by polling micros() from loop() (default), or
+ *  - from a hardware timer interrupt (MULTIPLEX_USE_TIMER_ISR), reading a
+ *    double-buffered copy of multiplexDisplayValues[] that loop() publishes
+ *
+ * With CLOCK_BRIGHTNESS_CONTROL, each tube's lit phase can be shortened (and
+ * its off phase lengthened by the same amount) to dim it, per tube and
+ * overall. The timer interrupt times phases to 0.5us on the Uno R1-R3 (50us
+ * on the R4), where polling is only as exact as loop() is quick.
+ * ============================================================================
+ */
+
+#ifndef _CLOCK_MULTIPLEX_H
+#define _CLOCK_MULTIPLEX_H
+
+#include "clock-config.h"
+#include "clock-hardware.h"
+#include "clock-instrumentation.h"
+#include "clock-cathode-wear.h"
+
+// ~120Hz / tube - tested on ИH-2 and ИH-12A tubes
+// Given Xms per-tube cycle, 1000ms / (Xms/tube * 6tubes) = Hz
+// 1.4ms ~= 120Hz
+// 2.8mz ~= 60Hz
+
+// const long MULTIPLEX_SINGLE_TUBE_LIT_DURATION_US = 750000L;
+// const long MULTIPLEX_SINGLE_TUBE_OFF_DURATION_US = 500000L;
+// const int MULTIPLEX_SINGLE_TUBE_LIT_DURATION_US = 2700;
+// const int MULTIPLEX_SINGLE_TUBE_OFF_DURATION_US =  100;
+const int MULTIPLEX_SINGLE_TUBE_LIT_DURATION_US = 1300;
+const int MULTIPLEX_SINGLE_TUBE_OFF_DURATION_US =  100;
+const unsigned int MULTIPLEX_TUBE_SLOT_US = MULTIPLEX_SINGLE_TUBE_LIT_DURATION_US + MULTIPLEX_SINGLE_TUBE_OFF_DURATION_US;
+
+#if defined(CLOCK_BRIGHTNESS_CONTROL)
+  // Per-tube trim, in percent of MULTIPLEX_SINGLE_TUBE_LIT_DURATION_US, to
+  // even out tubes that glow brighter than the rest (e.g. when mixing ИH-2 &
+  // ИH-12A tubes). Applied before the overall brightness.
+  const byte TUBE_BRIGHTNESS_TRIM_PERCENT[TUBE_COUNT] = {100, 100, 100, 100, 100, 100};
+
+  // below this, tubes don't strike reliably
+  const unsigned int MULTIPLEX_MIN_LIT_DURATION_US = 100;
+
+  // Each tube's lit phase at the current brightness. Its off phase is the
+  // rest of its slot, so the refresh rate stays the same at any brightness.
+  volatile unsigned int multiplexLitDurationsUS[TUBE_COUNT] = {
+    MULTIPLEX_SINGLE_TUBE_LIT_DURATION_US, MULTIPLEX_SINGLE_TUBE_LIT_DURATION_US,
+    MULTIPLEX_SINGLE_TUBE_LIT_DURATION_US, MULTIPLEX_SINGLE_TUBE_LIT_DURATION_US,
+    MULTIPLEX_SINGLE_TUBE_LIT_DURATION_US, MULTIPLEX_SINGLE_TUBE_LIT_DURATION_US
+  };
+
+  #define multiplexLitDurationUS(tubeIndex) (multiplexLitDurationsUS[tubeIndex])
+  #define multiplexOffDurationUS(tubeIndex) (MULTIPLEX_TUBE_SLOT_US - multiplexLitDurationsUS[tubeIndex])
+#else
+  #define multiplexLitDurationUS(tubeIndex) (MULTIPLEX_SINGLE_TUBE_LIT_DURATION_US)
+  #define multiplexOffDurationUS(tubeIndex) (MULTIPLEX_SINGLE_TUBE_OFF_DURATION_US)
+#endif
+
+// nixie tube state 🚥🚥
+byte multiplexDisplayValues[TUBE_COUNT] = {BLANK, BLANK, BLANK, BLANK, BLANK, BLANK};
+bool multiplexDisplayChanged = false; // since the last publishMultiplexFrame()
+volatile byte lastDisplayRefreshTubeIndex = TUBE_COUNT;
+volatile bool multiplexIsLit = false;
+unsigned long lastDisplayRefreshTimestampUS = 0UL;
+unsigned int multiplexPhaseDurationUS = 0;
+
+#if defined(MULTIPLEX_USE_TIMER_ISR)
+  // The ISR only ever reads multiplexFrameBuffers[multiplexFrontBuffer], and
+  // loop() only ever writes the other one, then flips multiplexFrontBuffer
+  // (a single byte write, so the swap is atomic).
+  volatile byte multiplexFrameBuffers[2][TUBE_COUNT] = {
+    {BLANK, BLANK, BLANK, BLANK, BLANK, BLANK},
+    {BLANK, BLANK, BLANK, BLANK, BLANK, BLANK}
+  };
+  volatile byte multiplexFrontBuffer = 0;
+  bool multiplexTimerRunning = false;
+
+  #define multiplexFrameValue(tubeIndex) (multiplexFrameBuffers[multiplexFrontBuffer][tubeIndex])
+#else
+  #define multiplexFrameValue(tubeIndex) (multiplexDisplayValues[tubeIndex])
+#endif
+
+// Advance the multiplexer by one phase (either blank the lit tube, or light
+// the next one), returning how long that phase should last.
+inline unsigned int multiplexStep() {
+  if (multiplexIsLit) {
+    blankTubes();
+    instrumentTubeBlanked();
+    multiplexIsLit = false;
+    return multiplexOffDurationUS(lastDisplayRefreshTubeIndex);
+  }
+
+  byte tubeIndex = lastDisplayRefreshTubeIndex;
+  if (tubeIndex == 0) {
+    tubeIndex = TUBE_COUNT - 1;
+  } else {
+    tubeIndex--;
+  }
+  lastDisplayRefreshTubeIndex = tubeIndex;
+
+  byte displayVal = multiplexFrameValue(tubeIndex);
+  displayOnTube(tubeIndex, displayVal);
+  countCathodeLit(tubeIndex, displayVal);
+  instrumentTubeLit();
+  multiplexIsLit = true;
+  return multiplexLitDurationUS(tubeIndex);
+}
+
+#if defined(CLOCK_BRIGHTNESS_CONTROL)
+
+// set every tube's lit phase to `percent` of its trimmed full brightness
+inline void setMultiplexBrightness(byte percent) {
+  unsigned int durationsUS[TUBE_COUNT];
+
+  for (byte i = 0; i < TUBE_COUNT; i++) {
+    unsigned long durationUS = (unsigned long)MULTIPLEX_SINGLE_TUBE_LIT_DURATION_US
+      * TUBE_BRIGHTNESS_TRIM_PERCENT[i] * percent / 10000UL;
+
+    if (durationUS < MULTIPLEX_MIN_LIT_DURATION_US) {
+      durationUS = MULTIPLEX_MIN_LIT_DURATION_US;
+    } else if (durationUS > MULTIPLEX_TUBE_SLOT_US - MULTIPLEX_SINGLE_TUBE_OFF_DURATION_US) {
+      durationUS = MULTIPLEX_TUBE_SLOT_US - MULTIPLEX_SINGLE_TUBE_OFF_DURATION_US;
+    }
+    durationsUS[i] = durationUS;
+  }
+
+  // 16-bit values, which the timer interrupt mustn't read half-written
+  noInterrupts();
+  for (byte i = 0; i < TUBE_COUNT; i++) {
+    multiplexLitDurationsUS[i] = durationsUS[i];
+  }
+  interrupts();
+}
+
+#endif
+
+#if defined(MULTIPLEX_USE_TIMER_ISR)
+
+inline void publishMultiplexFrame() {
+  if (!multiplexDisplayChanged) {
+    return;
+  }
+  multiplexDisplayChanged = false;
+
+  byte back = multiplexFrontBuffer ^ 1;
+
+  for (byte i = 0; i < TUBE_COUNT; i++) {
+    multiplexFrameBuffers[back][i] = multiplexDisplayValues[i];
+  }
+
+  multiplexFrontBuffer = back;
+}
+
+#if defined(ARDUINO_AVR_UNO)
+
+// Timer1 in CTC mode, prescaler 8: one tick every 0.5us at 16MHz. The compare
+// value is reloaded on every interrupt with the length of the phase that just
+// started.
+const byte MULTIPLEX_TIMER_TICKS_PER_US = 2;
+
+ISR(TIMER1_COMPA_vect) {
+  OCR1A = multiplexStep() * MULTIPLEX_TIMER_TICKS_PER_US - 1;
+}
+
+inline bool setupMultiplexTimer() {
+  noInterrupts();
+  TCCR1A = 0;
+  TCCR1B = (1 << WGM12) | (1 << CS11);
+  TCNT1 = 0;
+  OCR1A = MULTIPLEX_SINGLE_TUBE_OFF_DURATION_US * MULTIPLEX_TIMER_TICKS_PER_US - 1;
+  TIMSK1 |= (1 << OCIE1A);
+  interrupts();
+
+  return true;
+}
+
+#elif defined(ARDUINO_UNOWIFIR4)
+
+#include <FspTimer.h>
+
+// The FSP timer runs at a fixed tick, and phases are counted in ticks, since
+// reprogramming the GPT period from its own overflow callback only takes
+// effect on the following cycle.
+const unsigned int MULTIPLEX_TIMER_TICK_US = 50;
+
+FspTimer multiplexTimer;
+volatile unsigned int multiplexTicksRemaining = 0;
+
+inline void multiplexTimerCallback(timer_callback_args_t* args) {
+  if (multiplexTicksRemaining > 1) {
+    multiplexTicksRemaining--;
+    return;
+  }
+
+  multiplexTicksRemaining = multiplexStep() / MULTIPLEX_TIMER_TICK_US;
+}
+
+inline bool setupMultiplexTimer() {
+  uint8_t timerType = GPT_TIMER;
+  int8_t timerChannel = FspTimer::get_available_timer(timerType);
+
+  if (timerChannel < 0) {
+    return false;
+  }
+
+  return multiplexTimer.begin(TIMER_MODE_PERIODIC, timerType, timerChannel, 1000000.0f / MULTIPLEX_TIMER_TICK_US, 0.0f, multiplexTimerCallback)
+    && multiplexTimer.setup_overflow_irq()
+    && multiplexTimer.open()
+    && multiplexTimer.start();
+}
+
+#else
+
+// no hardware timer (e.g. host simulation): setupMultiplex() falls back to polling
+inline bool setupMultiplexTimer() {
+  return false;
+}
+
+#endif
+
+#endif
+
+inline void setupMultiplex() {
+  #if defined(MULTIPLEX_USE_TIMER_ISR)
+    multiplexTimerRunning = setupMultiplexTimer();
+
+    if (!multiplexTimerRunning) {
+      Serial.println(F("Multiplex timer unavailable, falling back to polling"));
+    }
+  #endif
+}
+
+// only flags a change (for publishMultiplexFrame()) if a tube's value differs
+inline void setMultiplexFrame(const byte frame[TUBE_COUNT]) {
+  for (byte i = 0; i < TUBE_COUNT; i++) {
+    if (multiplexDisplayValues[i] != frame[i]) {
+      multiplexDisplayValues[i] = frame[i];
+      multiplexDisplayChanged = true;
+    }
+  }
+}
+
+// blank the display right away (e.g. on a state change), rather than waiting
+// for the multiplexer to catch up with new values
+inline void blankMultiplex() {
+  #if defined(MULTIPLEX_USE_TIMER_ISR)
+    noInterrupts();
+    blankTubes();
+    interrupts();
+  #else
+    blankTubes();
+  #endif
+}
+
+inline void loopMultiplex() {
+  loopCathodeUsage();
+
+  #if defined(MULTIPLEX_USE_TIMER_ISR)
+    publishMultiplexFrame();
+
+    if (multiplexTimerRunning) {
+      return;
+    }
+  #endif
+
+  if (micros() - lastDisplayRefreshTimestampUS >= multiplexPhaseDurationUS) {
+    multiplexPhaseDurationUS = multiplexStep();
+    lastDisplayRefreshTimestampUS = micros();
+  }
+}
+
+#endif _CLOCK_MULTIPLEX_H
@@ -0,0 +1,99 @@
+/*
+ * ============================================================================
+ * Low Power (CLOCK_LOW_POWER)
+ *
+ * Sleep primitives for the power management in arduinix-chess-clock.ino:
+ *
+ *  - sleepUntilButton(): for CLOCK_IDLE, where no time is being kept. On the
+ *    Uno R1-R3 this is power-down, woken by a pin change on any button pin
+ *    (or idle sleep, if Serial commands are enabled, since the UART can't
+ *    wake the chip from power-down). millis() stands still while asleep.
+ *
+ *  - sleepUntilNextTick(): for a running turn with the display off. Idle
+ *    sleep on the Uno R1-R3, which only stops the CPU: Timer0 keeps running,
+ *    so millis() (and the turn) stays exact, and the next millis() tick,
+ *    button edge or byte received wakes it up again.
+ *
+ * Neither uses the watchdog as a timebase: it's only accurate to ~10%, which
+ * is too far off to time a game by. (The Uno R4 WiFi's on-chip RTC, which
+ * clock-journal.h uses across power cuts, only counts whole seconds.)
+ *
+ * On the Uno R4 WiFi, both wait for the next interrupt (at least the 1ms
+ * SysTick), leaving the WiFi module & notification outbox running. The host
+ * simulation doesn't sleep.
+ * ============================================================================
+ */
+
+#ifndef _CLOCK_POWER_H
+#define _CLOCK_POWER_H
+
+#include "clock-config.h"
+
+#if defined(CLOCK_LOW_POWER)
+
+// stay awake for a while after the last press before sleeping in CLOCK_IDLE
+const unsigned long IDLE_SLEEP_DELAY_MS = 10000UL;
+
+// turn the display off during turns of at least this long (i.e. the 24h, 48h
+// and 72h correspondence limits) once no button has been pressed for a while
+const unsigned long LONG_TURN_MIN_LIMIT_MS = 86400000UL;
+const unsigned long LONG_TURN_DISPLAY_OFF_AFTER_MS = 30000UL;
+
+#if defined(ARDUINO_AVR_UNO)
+
+#include <avr/sleep.h>
+
+#if !defined(BUTTON_CAPTURE_INTERRUPTS)
+  // only there to wake the CPU (with BUTTON_CAPTURE_INTERRUPTS, the edge
+  // capture handler on the same vector does that)
+  EMPTY_INTERRUPT(PCINT1_vect);
+#endif
+
+inline void sleepUntilButton() {
+  Serial.flush();
+
+  // A0, A1 & A4 are PCINT8, PCINT9 & PCINT12 (see setupButtonCapture())
+  PCMSK1 |= (1 << PCINT8) | (1 << PCINT9) | (1 << PCINT12);
+  PCIFR = (1 << PCIF1);
+  PCICR |= (1 << PCIE1);
+
+  #if defined(CLOCK_SERIAL_COMMANDS)
+    set_sleep_mode(SLEEP_MODE_IDLE);
+  #else
+    set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+  #endif
+
+  sleep_enable();
+  sleep_cpu();
+  sleep_disable();
+
+  #if !defined(BUTTON_CAPTURE_INTERRUPTS)
+    PCICR &= ~(1 << PCIE1);
+  #endif
+}
+
+inline void sleepUntilNextTick() {
+  set_sleep_mode(SLEEP_MODE_IDLE);
+  sleep_mode();
+}
+
+#elif defined(ARDUINO_UNOWIFIR4)
+
+inline void sleepUntilButton() {
+  __WFI();
+}
+
+inline void sleepUntilNextTick() {
+  __WFI();
+}
+
+#else
+
+inline void sleepUntilButton() {}
+inline void sleepUntilNextTick() {}
+
+#endif
+
+#endif
+
+#endif _CLOCK_POWER_H
@@ -0,0 +1,307 @@
+/*
+ * ============================================================================
+ * Serial Output Scheduling (SERIAL_TX_SCHEDULER)
+ *
+ * Serial.print() waits whenever the transmit buffer (63 bytes on the Uno) is
+ * full, and at 115200 baud each byte takes ~87us to go out, so a burst of
+ * output can hold up loop(), and with it the polled multiplexer, for several
+ * milliseconds.
+ *
+ * With SERIAL_TX_SCHEDULER, loop-time output is written to one of two queues
+ * instead, and loopSerialOutput() moves as much of it to Serial as fits in the
+ * transmit buffer without waiting (Serial.availableForWrite()), so a long
+ * message goes out in chunks over several loops. Priority is per message: a
+ * message that has started going out is always finished first (so a line or
+ * frame is never split by another), then the next one is taken from the
+ * notification queue if it has one, else from the status queue. Each queued
+ * message is prefixed with its length, which isn't sent, to tell where it ends.
+ *
+ * Each message is written between serialMessageBegin() & serialMessageEnd(),
+ * and queued whole or not at all: if it doesn't fit, it's dropped, and its
+ * bytes counted. The status stream is sent again a moment later anyway, and
+ * the notification queue is sized to hold a few events' worth. Messages that
+ * had to wait in a queue are counted as deferred. When the counts change, a
+ * line is sent (at most every SERIAL_STATS_INTERVAL_MS) with the totals:
+ *
+ *   CCSERIAL,<notification bytes dropped>,<status bytes dropped>,<bytes deferred>
+ *
+ * Without SERIAL_TX_SCHEDULER, messages are written straight to Serial.
+ * Start-up output (e.g. WiFi diagnostics in setup()) always is, and so are the
+ * few long dumps that are only ever asked for (the move log, the INSTR
+ * histograms), which call serialFinishMessage() first, so as not to land in
+ * the middle of a message that's partly sent.
+ * ============================================================================
+ */
+
+#ifndef _CLOCK_SERIAL_OUT_H
+#define _CLOCK_SERIAL_OUT_H
+
+#include "clock-config.h"
+
+enum SerialChannel {
+  SERIAL_NOTIFICATIONS = 0,
+  SERIAL_STATUS = 1
+};
+
+#if defined(SERIAL_TX_SCHEDULER)
+
+const byte SERIAL_CHANNEL_COUNT = 2;
+const byte SERIAL_NOTIFICATION_QUEUE_SIZE = 128;
+const byte SERIAL_STATUS_QUEUE_SIZE = 64;
+const unsigned long SERIAL_STATS_INTERVAL_MS = 5000UL;
+
+typedef struct {
+  byte* buffer;
+  byte size;
+  byte head;      // next byte to send
+  byte tail;      // end of the queued messages
+  byte writeEnd;  // end of the message being written
+  byte used;      // bytes between head & writeEnd
+} SerialQueue;
+
+byte serialNotificationBuffer[SERIAL_NOTIFICATION_QUEUE_SIZE];
+byte serialStatusBuffer[SERIAL_STATUS_QUEUE_SIZE];
+
+SerialQueue serialQueues[SERIAL_CHANNEL_COUNT] = {
+  { serialNotificationBuffer, SERIAL_NOTIFICATION_QUEUE_SIZE, 0, 0, 0, 0 },
+  { serialStatusBuffer, SERIAL_STATUS_QUEUE_SIZE, 0, 0, 0, 0 }
+};
+
+// the message being written
+SerialChannel serialMessageChannel = SERIAL_NOTIFICATIONS;
+byte serialMessageQueuedBefore = 0;
+unsigned int serialMessageLength = 0;
+
+// the message being sent, if it's partly sent
+SerialChannel serialSendingChannel = SERIAL_NOTIFICATIONS;
+byte serialSendingRemaining = 0;
+
+unsigned long serialBytesDropped[SERIAL_CHANNEL_COUNT] = {0UL, 0UL};
+unsigned long serialBytesDeferred = 0UL;
+bool serialStatsChanged = false;
+unsigned long lastSerialStatsTimestampMS = 0UL;
+
+inline void serialQueuePush(SerialQueue* q, byte c) {
+  q->buffer[q->writeEnd] = c;
+  if (++q->writeEnd == q->size) {
+    q->writeEnd = 0;
+  }
+  q->used++;
+}
+
+inline byte serialQueuePop(SerialQueue* q) {
+  byte c = q->buffer[q->head];
+  if (++q->head == q->size) {
+    q->head = 0;
+  }
+  q->used--;
+  return c;
+}
+
+inline void serialMessageBegin(SerialChannel channel) {
+  SerialQueue* q = &serialQueues[channel];
+
+  serialMessageChannel = channel;
+  serialMessageQueuedBefore = q->used;
+  serialMessageLength = 0;
+  q->writeEnd = q->tail;
+
+  // room for the length, filled in by serialMessageEnd()
+  if (q->used < q->size) {
+    serialQueuePush(q, 0);
+  }
+}
+
+inline void serialWrite(byte c) {
+  SerialQueue* q = &serialQueues[serialMessageChannel];
+
+  serialMessageLength++;
+  if (q->used == q->size) {
+    return;
+  }
+
+  serialQueuePush(q, c);
+}
+
+inline void serialWrite(const byte* bytes, byte length) {
+  for (byte i = 0; i < length; i++) {
+    serialWrite(bytes[i]);
+  }
+}
+
+// returns false if the message was dropped
+inline bool serialMessageEnd() {
+  SerialQueue* q = &serialQueues[serialMessageChannel];
+
+  // (plus its length)
+  if ((unsigned int)(q->used - serialMessageQueuedBefore) < serialMessageLength + 1) {
+    // didn't fit: drop the whole message, rather than send part of it
+    serialBytesDropped[serialMessageChannel] += serialMessageLength;
+    q->used = serialMessageQueuedBefore;
+    q->writeEnd = q->tail;
+    serialStatsChanged = true;
+    return false;
+  }
+
+  if (serialMessageQueuedBefore > 0 || serialSendingRemaining > 0 || Serial.availableForWrite() < (int)serialMessageLength) {
+    serialBytesDeferred += serialMessageLength;
+    serialStatsChanged = true;
+  }
+
+  q->buffer[q->tail] = serialMessageLength;
+  q->tail = q->writeEnd;
+  return true;
+}
+
+inline bool serialOutputPending() {
+  return serialQueues[SERIAL_NOTIFICATIONS].used > 0 || serialQueues[SERIAL_STATUS].used > 0;
+}
+
+#else
+
+inline void serialMessageBegin(SerialChannel channel) {}
+inline bool serialMessageEnd() {
+  return true;
+}
+
+inline void serialWrite(byte c) {
+  Serial.write(c);
+}
+
+inline void serialWrite(const byte* bytes, byte length) {
+  Serial.write(bytes, length);
+}
+
+inline bool serialOutputPending() {
+  return false;
+}
+
+#endif
+
+inline void serialPrint(const char* s) {
+  while (*s) {
+    serialWrite((byte)*s++);
+  }
+}
+
+// for strings in flash (PROGMEM, e.g. PSTR("...") or an option label)
+inline void serialPrintFlash(const char* s) {
+  char c;
+  while ((c = pgm_read_byte(s++))) {
+    serialWrite((byte)c);
+  }
+}
+
+inline void serialPrintNumber(unsigned long n) {
+  char digits[10];
+  byte count = 0;
+
+  do {
+    digits[count++] = '0' + n % 10;
+    n /= 10;
+  } while (n > 0);
+
+  while (count > 0) {
+    serialWrite((byte)digits[--count]);
+  }
+}
+
+inline void serialPrintln() {
+  serialPrint("\r\n");
+}
+
+#if defined(SERIAL_TX_SCHEDULER)
+
+inline void serialWriteStats(unsigned long loopNow) {
+  if (!serialStatsChanged || loopNow - lastSerialStatsTimestampMS < SERIAL_STATS_INTERVAL_MS) {
+    return;
+  }
+  lastSerialStatsTimestampMS = loopNow;
+
+  serialMessageBegin(SERIAL_STATUS);
+  serialPrint("CCSERIAL,");
+  serialPrintNumber(serialBytesDropped[SERIAL_NOTIFICATIONS]);
+  serialPrint(",");
+  serialPrintNumber(serialBytesDropped[SERIAL_STATUS]);
+  serialPrint(",");
+  serialPrintNumber(serialBytesDeferred);
+  serialPrintln();
+  serialMessageEnd();
+
+  // (not counting this report itself)
+  serialStatsChanged = false;
+}
+
+// Takes the next message to send, from the highest priority queue that has
+// one. Returns false if they're all empty.
+inline bool serialNextMessage() {
+  for (byte c = 0; c < SERIAL_CHANNEL_COUNT; c++) {
+    SerialQueue* q = &serialQueues[c];
+
+    if (q->used > 0) {
+      serialSendingChannel = (SerialChannel)c;
+      serialSendingRemaining = serialQueuePop(q);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// Writes out up to `room` bytes of the message being sent, in contiguous runs
+// up to the end of the buffer. Returns the number of bytes written.
+inline int serialSendMessage(int room) {
+  SerialQueue* q = &serialQueues[serialSendingChannel];
+  int sent = 0;
+
+  while (sent < room && serialSendingRemaining > 0) {
+    byte run = q->size - q->head;
+    if (run > serialSendingRemaining) {
+      run = serialSendingRemaining;
+    }
+    if (run > room - sent) {
+      run = room - sent;
+    }
+
+    Serial.write(&q->buffer[q->head], run);
+    sent += run;
+    serialSendingRemaining -= run;
+    q->used -= run;
+    q->head += run;
+    if (q->head == q->size) {
+      q->head = 0;
+    }
+  }
+
+  return sent;
+}
+
+// never waits: only writes what the transmit buffer has room for
+inline void loopSerialOutput(unsigned long loopNow) {
+  serialWriteStats(loopNow);
+
+  int room = Serial.availableForWrite();
+
+  while (room > 0) {
+    if (serialSendingRemaining == 0 && !serialNextMessage()) {
+      return;
+    }
+
+    room -= serialSendMessage(room);
+  }
+}
+
+// Waits for the rest of a partly sent message to go out, so that a direct
+// Serial.print() can follow it. Anything still queued goes out afterwards.
+inline void serialFinishMessage() {
+  serialSendMessage(serialSendingRemaining);
+}
+
+#else
+
+inline void loopSerialOutput(unsigned long loopNow) {}
+inline void serialFinishMessage() {}
+
+#endif
+
+#endif _CLOCK_SERIAL_OUT_H
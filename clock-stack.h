@@ -0,0 +1,103 @@
+/*
+ * ============================================================================
+ * Stack Usage Report (CLOCK_STACK_REPORT)
+ *
+ * The Uno R1-R3 has 2KB of RAM: the static data (.data & .bss) at the bottom,
+ * and the stack growing down from the top towards it. How much static data
+ * there is, is known at build time (see tools/memory-budget.mjs), but how deep
+ * the stack goes is only known by running the clock.
+ *
+ * So straight after reset, before even the C runtime's own start-up code, all
+ * of the RAM above the static data is painted with STACK_PAINT. Whatever the
+ * stack has used since then has been overwritten, so scanning up from the
+ * bottom for the first byte that isn't paint finds the deepest it has gone.
+ * That's reported at the end of setup(), and then every
+ * STACK_REPORT_INTERVAL_MS, as:
+ *
+ *   CCSTACK,<deepest stack use, bytes>,<bytes never touched>
+ *
+ * (The heap would grow up into the same space, but nothing here uses malloc.)
+ *
+ * Only on the Uno R1-R3: elsewhere, this compiles away.
+ * ============================================================================
+ */
+
+#ifndef _CLOCK_STACK_H
+#define _CLOCK_STACK_H
+
+#include "clock-config.h"
+
+#if defined(CLOCK_STACK_REPORT) && defined(ARDUINO_AVR_UNO)
+
+const byte STACK_PAINT = 0xC5;
+const unsigned long STACK_REPORT_INTERVAL_MS = 10000UL;
+
+extern uint8_t _end;    // the end of the static data
+extern uint8_t __stack; // the top of RAM, where the stack starts
+
+unsigned long lastStackReportTimestampMS = 0UL;
+
+// .init1 code runs inline straight after reset (it isn't called, so mustn't
+// return), before the stack pointer & zero register are set up: hence naked,
+// and in assembly
+void paintStack() __attribute__((naked, used, section(".init1")));
+void paintStack() {
+  asm volatile (
+    "  ldi r30, lo8(_end)\n"
+    "  ldi r31, hi8(_end)\n"
+    "  ldi r24, %[paint]\n"
+    "  ldi r25, hi8(__stack)\n"
+    "  rjmp 2f\n"
+    "1:\n"
+    "  st Z+, r24\n"
+    "2:\n"
+    "  cpi r30, lo8(__stack)\n"
+    "  cpc r31, r25\n"
+    "  brlo 1b\n"
+    "  breq 1b\n"
+    :: [paint] "M" (STACK_PAINT)
+  );
+}
+
+inline unsigned int untouchedStackBytes() {
+  const volatile uint8_t* p = &_end;
+  while (p <= &__stack && *p == STACK_PAINT) {
+    p++;
+  }
+
+  return p - &_end;
+}
+
+inline void reportStackUsage() {
+  unsigned int untouched = untouchedStackBytes();
+
+  serialMessageBegin(SERIAL_STATUS);
+  serialPrintFlash(PSTR("CCSTACK,"));
+  serialPrintNumber(&__stack - &_end + 1 - untouched);
+  serialPrint(",");
+  serialPrintNumber(untouched);
+  serialPrintln();
+  serialMessageEnd();
+}
+
+inline void setupStackReport() {
+  reportStackUsage();
+}
+
+inline void loopStackReport(unsigned long loopNow) {
+  if (loopNow - lastStackReportTimestampMS < STACK_REPORT_INTERVAL_MS) {
+    return;
+  }
+  lastStackReportTimestampMS = loopNow;
+
+  reportStackUsage();
+}
+
+#else
+
+inline void setupStackReport() {}
+inline void loopStackReport(unsigned long loopNow) {}
+
+#endif
+
+#endif _CLOCK_STACK_H
@@ -3,8 +3,21 @@
 
 #define playerString(leftPlayersTurn) (leftPlayersTurn ? "Left" : "Right")
 
-const char* NEW_GAME_MSG = "New Game Started! Turn Limit: %s | Starting Player: %s";
-const char* TURN_CHANGE_MSG = "Your Move!";
-const char* TIMEOUT_MSG = "Game Over! %s Player Timed Out";
+// the label sent with notifications that don't have one (turn changes &
+// timeouts), in flash like the option labels (see clock-data-types.h)
+const char NO_LABEL[] PROGMEM = "-";
+
+// messages are sent as a sequence of fragments (see clock-wifi.h):
+//   NEW_GAME_MSG <label> NEW_GAME_MSG_PLAYER <player>
+//   TIMEOUT_MSG <player> TIMEOUT_MSG_END
+//
+// These are flash strings, like the option labels. Only the Uno R4 WiFi sends
+// them, where flash is addressed like RAM (PROGMEM does nothing), so they can
+// be used as plain strings there.
+const char NEW_GAME_MSG[] PROGMEM = "New Game Started! Turn Limit: ";
+const char NEW_GAME_MSG_PLAYER[] PROGMEM = " | Starting Player: ";
+const char TURN_CHANGE_MSG[] PROGMEM = "Your Move!";
+const char TIMEOUT_MSG[] PROGMEM = "Game Over! ";
+const char TIMEOUT_MSG_END[] PROGMEM = " Player Timed Out";
 
 #endif _CLOCK_STRINGS_H
@@ -0,0 +1,135 @@
+/*
+ * ============================================================================
+ * Binary Telemetry Framing (CLOCK_BINARY_TELEMETRY)
+ *
+ * Compact binary frames for the clock's status stream & notification events,
+ * sent over Serial in place of the text lines, and decoded by
+ * notification-protocol.mjs (alongside any text lines still in the stream):
+ *
+ *   0xA5 | type | seq | len | payload (len bytes) | CRC-16 (little-endian)
+ *
+ * seq counts up by one with every frame sent, so a receiver can tell when
+ * frames were lost on the way. Frames the clock couldn't send at all (the
+ * transmit buffer or Serial queue was full) are counted in each status frame. The CRC is CRC-16/CCITT-FALSE (polynomial 0x1021,
+ * initial value 0xFFFF) over type, seq, len & payload. Multi-byte payload
+ * fields are fixed-width and little-endian:
+ *
+ *   TELEMETRY_FRAME_STATUS (21 bytes)
+ *     u8 clock state | u8 menu option | u8 flags (bit 0: left player's turn)
+ *     u32 elapsed ms | u32 remaining ms | u32 left bank ms | u32 right bank ms
+ *     u16 frames skipped (since power on, wrapping; see below)
+ *
+ *   TELEMETRY_FRAME_NOTIFICATION (2 bytes + label)
+ *     u8 NotificationType | u8 flags (bit 0: left player's turn) | label chars
+ * ============================================================================
+ */
+
+#ifndef _CLOCK_TELEMETRY_H
+#define _CLOCK_TELEMETRY_H
+
+#include "clock-config.h"
+#include "clock-serial-out.h"
+
+#if defined(CLOCK_BINARY_TELEMETRY)
+
+const byte TELEMETRY_SYNC = 0xA5;
+const byte TELEMETRY_FRAME_STATUS = 0x01;
+const byte TELEMETRY_FRAME_NOTIFICATION = 0x02;
+
+const byte TELEMETRY_HEADER_SIZE = 4;
+const byte TELEMETRY_CRC_SIZE = 2;
+const byte TELEMETRY_MAX_PAYLOAD_SIZE = 32;
+
+const byte TELEMETRY_FLAG_LEFT_PLAYERS_TURN = 1 << 0;
+
+// 50Hz; the status frame is 27 bytes on the wire
+const unsigned int TELEMETRY_STATUS_INTERVAL_MS = 20;
+
+// CRC-16/CCITT-FALSE, a nibble at a time, from a 16 entry table
+const uint16_t TELEMETRY_CRC_TABLE[16] PROGMEM = {
+  0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+  0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF
+};
+
+byte telemetrySequence = 0;
+unsigned int telemetryFramesSkipped = 0;
+
+inline uint16_t telemetryCrcUpdate(uint16_t crc, byte b) {
+  crc = (crc << 4) ^ pgm_read_word(&TELEMETRY_CRC_TABLE[(crc >> 12) ^ (b >> 4)]);
+  crc = (crc << 4) ^ pgm_read_word(&TELEMETRY_CRC_TABLE[(crc >> 12) ^ (b & 0x0F)]);
+  return crc;
+}
+
+inline void putTelemetryU16(byte* payload, unsigned int value) {
+  payload[0] = value;
+  payload[1] = value >> 8;
+}
+
+inline void putTelemetryU32(byte* payload, unsigned long value) {
+  payload[0] = value;
+  payload[1] = value >> 8;
+  payload[2] = value >> 16;
+  payload[3] = value >> 24;
+}
+
+// Writes one frame. With `skipIfBusy`, the frame is dropped (and counted)
+// rather than waiting on a full Serial transmit buffer, so that a fast status
+// stream can never hold up loop(). (With SERIAL_TX_SCHEDULER, nothing waits:
+// `skipIfBusy` frames go in the status queue, the rest in the notification
+// queue, and a frame is only dropped if its queue is full.)
+inline bool sendTelemetryFrame(byte type, const byte* payload, byte length, bool skipIfBusy) {
+  if (length > TELEMETRY_MAX_PAYLOAD_SIZE) {
+    length = TELEMETRY_MAX_PAYLOAD_SIZE;
+  }
+
+  #if !defined(SERIAL_TX_SCHEDULER)
+    if (skipIfBusy && Serial.availableForWrite() < TELEMETRY_HEADER_SIZE + length + TELEMETRY_CRC_SIZE) {
+      telemetryFramesSkipped++;
+      return false;
+    }
+  #endif
+
+  byte header[TELEMETRY_HEADER_SIZE] = { TELEMETRY_SYNC, type, telemetrySequence++, length };
+
+  uint16_t crc = 0xFFFF;
+  for (byte i = 1; i < TELEMETRY_HEADER_SIZE; i++) {
+    crc = telemetryCrcUpdate(crc, header[i]);
+  }
+  for (byte i = 0; i < length; i++) {
+    crc = telemetryCrcUpdate(crc, payload[i]);
+  }
+
+  byte trailer[TELEMETRY_CRC_SIZE] = { (byte)crc, (byte)(crc >> 8) };
+
+  serialMessageBegin(skipIfBusy ? SERIAL_STATUS : SERIAL_NOTIFICATIONS);
+  serialWrite(header, TELEMETRY_HEADER_SIZE);
+  serialWrite(payload, length);
+  serialWrite(trailer, TELEMETRY_CRC_SIZE);
+
+  if (!serialMessageEnd()) {
+    telemetryFramesSkipped++;
+    return false;
+  }
+  return true;
+}
+
+inline void sendTelemetryNotification(byte type, bool leftPlayersTurn, const char* label) {
+  byte payload[TELEMETRY_MAX_PAYLOAD_SIZE];
+  byte length = 0;
+
+  payload[length++] = type;
+  payload[length++] = leftPlayersTurn ? TELEMETRY_FLAG_LEFT_PLAYERS_TURN : 0;
+
+  // the label is a flash string (see clock-data-types.h)
+  char c;
+  while ((c = pgm_read_byte(label++)) && length < TELEMETRY_MAX_PAYLOAD_SIZE) {
+    payload[length++] = c;
+  }
+
+  // notifications are rare & matter: wait for room rather than skip
+  sendTelemetryFrame(TELEMETRY_FRAME_NOTIFICATION, payload, length, false);
+}
+
+#endif
+
+#endif _CLOCK_TELEMETRY_H
@@ -0,0 +1,132 @@
+/*
+ * ============================================================================
+ * Incremental Time Digits
+ *
+ * Keeps a millisecond count as individual decimal digits (hours, minutes,
+ * seconds, centiseconds & milliseconds, tens and ones), advanced or rewound
+ * by the change since the last update with digit-by-digit carries and
+ * borrows. On an 8-bit AVR this avoids the chain of 32-bit software divisions
+ * needed to split a millisecond count into display digits on every loop.
+ * Only a first update, or a jump of more than TIME_DIGITS_MAX_STEP_MS (e.g. a
+ * turn change), falls back to dividing.
+ * ============================================================================
+ */
+
+#ifndef _CLOCK_TIME_DIGITS_H
+#define _CLOCK_TIME_DIGITS_H
+
+// least significant first
+enum TimeDigit {
+  TD_MS,
+  TD_CS1,
+  TD_CS10,
+  TD_S1,
+  TD_S10,
+  TD_M1,
+  TD_M10,
+  TD_H1,
+  TD_H10,
+  TIME_DIGIT_COUNT
+};
+
+// in flash, like the other lookup tables: read with pgm_read_*()
+const byte TIME_DIGIT_RADIX[TIME_DIGIT_COUNT] PROGMEM = {10, 10, 10, 10, 6, 10, 6, 10, 10};
+
+const unsigned long TIME_DIGITS_MAX_STEP_MS = 5000UL;
+
+const byte TIME_DIGIT_STEP_COUNT = 4;
+const uint16_t TIME_DIGIT_STEP_UNITS_MS[TIME_DIGIT_STEP_COUNT] PROGMEM = {1000, 100, 10, 1};
+const byte TIME_DIGIT_STEP_POSITIONS[TIME_DIGIT_STEP_COUNT] PROGMEM = {TD_S1, TD_CS10, TD_CS1, TD_MS};
+
+typedef struct {
+  unsigned long totalMS;
+  byte digits[TIME_DIGIT_COUNT];
+  bool valid;
+} TimeDigits;
+
+inline void seedTimeDigits(TimeDigits& t, unsigned long totalMS) {
+  unsigned long totalSec = totalMS / 1000;
+  unsigned int subSecondMS = totalMS % 1000;
+  byte hours = totalSec / 3600;
+  unsigned int hoursRemainder = totalSec % 3600;
+  byte min = hoursRemainder / 60;
+  byte sec = hoursRemainder % 60;
+  byte cs = subSecondMS / 10;
+
+  t.digits[TD_MS] = subSecondMS % 10;
+  t.digits[TD_CS1] = cs % 10;
+  t.digits[TD_CS10] = cs / 10;
+  t.digits[TD_S1] = sec % 10;
+  t.digits[TD_S10] = sec / 10;
+  t.digits[TD_M1] = min % 10;
+  t.digits[TD_M10] = min / 10;
+  t.digits[TD_H1] = hours % 10;
+  t.digits[TD_H10] = hours / 10;
+  t.totalMS = totalMS;
+  t.valid = true;
+}
+
+// add one unit at the given digit position, carrying upward, and return the
+// highest position that changed
+inline byte incrementTimeDigit(TimeDigits& t, byte position) {
+  for (byte i = position; i < TIME_DIGIT_COUNT; i++) {
+    if (++t.digits[i] < pgm_read_byte(&TIME_DIGIT_RADIX[i])) {
+      return i;
+    }
+    t.digits[i] = 0;
+  }
+  return TIME_DIGIT_COUNT - 1;
+}
+
+// subtract one unit at the given digit position, borrowing from above, and
+// return the highest position that changed
+inline byte decrementTimeDigit(TimeDigits& t, byte position) {
+  for (byte i = position; i < TIME_DIGIT_COUNT; i++) {
+    if (t.digits[i] > 0) {
+      t.digits[i]--;
+      return i;
+    }
+    t.digits[i] = pgm_read_byte(&TIME_DIGIT_RADIX[i]) - 1;
+  }
+  return TIME_DIGIT_COUNT - 1;
+}
+
+// Move the digits to totalMS. Returns true if anything from centiseconds
+// upward changed (i.e. anything the display can show).
+inline bool updateTimeDigits(TimeDigits& t, unsigned long totalMS) {
+  if (t.valid && totalMS == t.totalMS) {
+    return false;
+  }
+
+  bool counting = totalMS > t.totalMS;
+  unsigned long delta = counting ? totalMS - t.totalMS : t.totalMS - totalMS;
+
+  if (!t.valid || delta > TIME_DIGITS_MAX_STEP_MS) {
+    seedTimeDigits(t, totalMS);
+    return true;
+  }
+
+  byte highestChanged = TD_MS;
+
+  // step in the largest units first: at most 5 + 9 + 9 + 9 steps
+  for (byte s = 0; s < TIME_DIGIT_STEP_COUNT; s++) {
+    unsigned int unitMS = pgm_read_word(&TIME_DIGIT_STEP_UNITS_MS[s]);
+    byte position = pgm_read_byte(&TIME_DIGIT_STEP_POSITIONS[s]);
+
+    while (delta >= unitMS) {
+      byte changed = counting
+        ? incrementTimeDigit(t, position)
+        : decrementTimeDigit(t, position);
+
+      if (changed > highestChanged) {
+        highestChanged = changed;
+      }
+      delta -= unitMS;
+    }
+  }
+
+  t.totalMS = totalMS;
+  return highestChanged >= TD_CS1;
+}
+
+#endif _CLOCK_TIME_DIGITS_H
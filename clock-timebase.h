@@ -0,0 +1,97 @@
+/*
+ * ============================================================================
+ * Monotonic Microsecond Timebase (CLOCK_HIGH_RES_TIMING)
+ *
+ * Extends micros() into a 64-bit count of microseconds since power on, which
+ * never wraps in practice, so turns can be timed to the microsecond instead
+ * of being rounded to millis(). Alongside it, a whole-millisecond count and
+ * the microseconds into the current millisecond are accumulated from the
+ * same deltas, so the display never needs a 64-bit division.
+ *
+ * micros() itself wraps around every ~71 minutes: loopTimebase() has to run
+ * at least that often (loop() calls it on every pass).
+ *
+ * When CLOCK_HIGH_RES_TIMING isn't defined, loopTimebase() compiles away.
+ * ============================================================================
+ */
+
+#ifndef _CLOCK_TIMEBASE_H
+#define _CLOCK_TIMEBASE_H
+
+#include "clock-config.h"
+
+#if defined(CLOCK_HIGH_RES_TIMING)
+
+typedef struct {
+  uint64_t us;
+  unsigned long ms;      // us / 1000
+  unsigned int subMsUS;  // us % 1000
+} MonotonicTime;
+
+MonotonicTime monotonicNow = { 0ULL, 0UL, 0 };
+unsigned long monotonicLastMicros = 0UL;
+
+inline void advanceMonotonicTime(MonotonicTime& t, unsigned long deltaUS) {
+  t.us += deltaUS;
+
+  // loop() passes are well under 2ms apart, so this rarely needs to divide
+  unsigned long subMsUS = t.subMsUS + deltaUS;
+  if (subMsUS >= 2000UL) {
+    t.ms += subMsUS / 1000;
+    subMsUS %= 1000;
+  } else if (subMsUS >= 1000UL) {
+    t.ms++;
+    subMsUS -= 1000;
+  }
+  t.subMsUS = subMsUS;
+}
+
+inline const MonotonicTime& loopTimebase() {
+  unsigned long now = micros();
+
+  // 32-bit unsigned subtraction is correct across a single micros() wrap (the
+  // cast only matters for the host simulation, where unsigned long is 64-bit)
+  advanceMonotonicTime(monotonicNow, (uint32_t)(now - monotonicLastMicros));
+  monotonicLastMicros = now;
+
+  return monotonicNow;
+}
+
+// the monotonic time at an earlier micros() timestamp (e.g. a button edge),
+// which must be less than ~71 minutes old
+inline MonotonicTime monotonicTimeAt(unsigned long timestampUS) {
+  MonotonicTime t = loopTimebase();
+  unsigned long agoUS = (uint32_t)(monotonicLastMicros - timestampUS);
+  unsigned long agoMS = agoUS / 1000;
+  unsigned int agoSubMsUS = agoUS % 1000;
+
+  t.us -= agoUS;
+  if (t.subMsUS < agoSubMsUS) {
+    t.subMsUS += 1000;
+    t.ms--;
+  }
+  t.subMsUS -= agoSubMsUS;
+  t.ms -= agoMS;
+
+  return t;
+}
+
+// whole milliseconds from `since` to `now`, rounded down
+inline unsigned long monotonicElapsedMS(const MonotonicTime& since, const MonotonicTime& now) {
+  return now.ms - since.ms - (now.subMsUS < since.subMsUS ? 1 : 0);
+}
+
+// the microseconds past the last whole millisecond of that same interval
+inline unsigned int monotonicElapsedSubMsUS(const MonotonicTime& since, const MonotonicTime& now) {
+  return now.subMsUS >= since.subMsUS
+    ? now.subMsUS - since.subMsUS
+    : now.subMsUS + 1000 - since.subMsUS;
+}
+
+#else
+
+inline void loopTimebase() {}
+
+#endif
+
+#endif _CLOCK_TIMEBASE_H
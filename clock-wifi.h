@@ -4,6 +4,7 @@
 #include <WiFiS3.h>
 
 #include "clock-strings.h"
+#include "clock-serial-out.h"
 #include "clock-secrets.h"
 
 const char* SSID = SECRET_SSID;
@@ -11,55 +12,32 @@ const char* PASS = SECRET_PASS;
 
 const char* TOPIC_LEFT = SECRET_TOPIC_LEFT;
 const char* TOPIC_RIGHT = SECRET_TOPIC_RIGHT;
-const char* NTFY_SERVER = "ntfy.sh";
-const int NTFY_SERVER_PORT = 80;
-
-const char* CONN_KEEP_ALIVE = "keep-alive";
-const char* CONN_CLOSE = "close";
-const char* NTFY_REQUEST = "POST /%s HTTP/1.1\nHost: ntfy.sh\nContent-Type: text/plain\nContent-Length: %d\nConnection: %s\n\n%s\n";
+// ntfy.sh by default; define SECRET_NTFY_SERVER (and SECRET_NTFY_SERVER_PORT)
+// in clock-secrets.h to point the clock at another server, e.g. a local
+// stand-in for testing
+#if defined(SECRET_NTFY_SERVER)
+  const char* NTFY_SERVER = SECRET_NTFY_SERVER;
+#else
+  const char* NTFY_SERVER = "ntfy.sh";
+#endif
+
+#if defined(SECRET_NTFY_SERVER_PORT)
+  const int NTFY_SERVER_PORT = SECRET_NTFY_SERVER_PORT;
+#else
+  const int NTFY_SERVER_PORT = 80;
+#endif
+
+// the constant pieces of an ntfy request, which is written out as:
+//   NTFY_REQUEST_POST <topic> NTFY_REQUEST_HOST <server>
+//   NTFY_REQUEST_LENGTH <content length> NTFY_REQUEST_BODY <message>
+const char* NTFY_REQUEST_POST = "POST /";
+const char* NTFY_REQUEST_HOST = " HTTP/1.1\r\nHost: ";
+const char* NTFY_REQUEST_LENGTH = "\r\nContent-Type: text/plain\r\nContent-Length: ";
+const char* NTFY_REQUEST_BODY = "\r\nConnection: keep-alive\r\n\r\n";
 
 int wifiConnectionStatus = WL_IDLE_STATUS;
 WiFiClient client;
 
-inline void printMacAddress(byte mac[]) {
-  for (int i = 0; i < 6; i++) {
-    if (i > 0) {
-      Serial.print(":");
-    }
-    if (mac[i] < 16) {
-      Serial.print("0");
-    }
-    Serial.print(mac[i], HEX);
-  }
-  Serial.println();
-}
-
-inline void printNetworkInfo() {
-  Serial.print("IP Address: ");
-  IPAddress ip = WiFi.localIP();
-  Serial.println(ip);
-
-  Serial.print("MAC Address: ");
-  byte mac[6];
-  WiFi.macAddress(mac);
-  printMacAddress(mac);
-}
-
-inline void printWifiInfo() {
-  Serial.print("SSID: ");
-  Serial.println(WiFi.SSID());
-
-  // AP/Router MAC
-  byte bssid[6];
-  Serial.print("BSSID: ");
-  WiFi.BSSID(bssid);
-  printMacAddress(bssid);
-
-  Serial.print("Signal Strength (RSSI): ");
-  long rssi = WiFi.RSSI();
-  Serial.println(rssi);
-}
-
 inline const char* statusCodeString(int status) {
   switch(status) {
     case WL_IDLE_STATUS: return "WL_IDLE_STATUS";
@@ -77,120 +55,614 @@ inline const char* statusCodeString(int status) {
   }
 }
 
-inline bool setupWifi() {
-  wifiConnectionStatus = WiFi.status();
+#define playerTopic(leftPlayersTurn) (leftPlayersTurn ? TOPIC_LEFT : TOPIC_RIGHT)
+
+/*
+ * ntfy server connection
+ *
+ * One keep-alive connection to the ntfy server is held open across
+ * notifications, so that a turn change normally costs a single write, rather
+ * than a DNS lookup plus a TCP connect & teardown. The server's address is
+ * looked up once and cached (and looked up again if connecting to it fails).
+ *
+ * Responses are read and thrown away as they arrive, so they can't back up in
+ * the socket. When the server closes the connection (e.g. its idle timeout),
+ * that's noticed here, and a new connection is only made once the next
+ * notification needs it.
+ */
+const int NTFY_RESPONSE_DRAIN_BYTES = 64;
+
+// available() & connected() are each a round trip to the WiFi module, so
+// they're only polled this often
+const unsigned long NTFY_CONNECTION_CHECK_INTERVAL_MS = 250UL;
+
+IPAddress ntfyServerIP;
+bool ntfyServerIPResolved = false;
+bool ntfyConnected = false;
+unsigned int ntfyConnectionsOpened = 0;
+unsigned long ntfyLastCheckMS = 0UL;
+uint8_t ntfyResponseDrain[NTFY_RESPONSE_DRAIN_BYTES];
+
+inline void closeNtfyConnection() {
+  client.stop();
+  ntfyConnected = false;
+}
+
+// blocking (DNS lookup and/or TCP connect), so only called with a
+// notification waiting to go out
+inline bool openNtfyConnection() {
+  if (!ntfyServerIPResolved) {
+    ntfyServerIPResolved = WiFi.hostByName(NTFY_SERVER, ntfyServerIP) == 1;
+
+    if (!ntfyServerIPResolved) {
+      return false;
+    }
+  }
 
-  if (wifiConnectionStatus == WL_NO_MODULE) {
-    Serial.println("Communication with WiFi module failed!");
+  if (!client.connect(ntfyServerIP, NTFY_SERVER_PORT)) {
+    // the cached address may have gone stale
+    ntfyServerIPResolved = false;
     return false;
-  } else {
-    Serial.print("WiFi module status: ");
-    Serial.println(statusCodeString(wifiConnectionStatus));
   }
 
-  String fv = WiFi.firmwareVersion();
-  if (fv < WIFI_FIRMWARE_LATEST_VERSION) {
-    Serial.println("Please upgrade the WiFi module firmware.");
-    Serial.print("Current: ");
-    Serial.println(fv);
-    Serial.print("Latest: ");
-    Serial.println(WIFI_FIRMWARE_LATEST_VERSION);
-  } else {
-    Serial.print("WiFi module firmware is up-to-date: ");
-    Serial.println(fv);
+  ntfyConnected = true;
+  ntfyConnectionsOpened++;
+  return true;
+}
+
+// read & discard (a bounded amount of) any response data, and notice a
+// server-side close
+inline void loopNtfyConnection(unsigned long loopNow) {
+  if (!ntfyConnected || loopNow - ntfyLastCheckMS < NTFY_CONNECTION_CHECK_INTERVAL_MS) {
+    return;
   }
 
-  Serial.print("Attempting to connect to SSID: ");
-  Serial.println(SSID);
-  wifiConnectionStatus = WiFi.begin(SSID, PASS);
+  // while a response is coming in, keep draining on every loop
+  int available = client.available();
+  if (available > 0) {
+    client.read(ntfyResponseDrain, min(available, NTFY_RESPONSE_DRAIN_BYTES));
+    return;
+  }
 
-  if (wifiConnectionStatus == WL_CONNECTED) {
-    Serial.println("WiFi Connected!");
-    printWifiInfo();
-    printNetworkInfo();
-  } else {
-    Serial.print("Error connecting to WiFi network! Status: ");
-    Serial.println(statusCodeString(wifiConnectionStatus));
+  ntfyLastCheckMS = loopNow;
+
+  if (!client.connected()) {
+    closeNtfyConnection();
   }
+}
 
-  return wifiConnectionStatus == WL_CONNECTED;
+/*
+ * WiFi link
+ *
+ * Bringing the link up is a state machine advanced by loopWifi() (called from
+ * loopHardware()), so that the clock is usable straight away at power on, and
+ * stays usable while the access point is out of reach. WiFi.begin() would
+ * otherwise wait up to 10s for the connection, so its timeout is set to 0:
+ * it only starts connecting, and WiFi.status() is polled from then on.
+ *
+ * Once connected, the ESP32-S3 reconnects by itself after a dropped link, so
+ * the link is given WIFI_CONNECT_TIMEOUT_MS to come back before WiFi.begin()
+ * is tried again. Failed attempts are retried after a growing delay.
+ *
+ * Notifications wait in the outbox until the link is up. Meanwhile, the
+ * button LEDs show its progress while the clock is idle (wifiStatusLEDs()).
+ */
+enum WifiLinkState {
+  WIFI_START,           // check the module, before the first connection attempt
+  WIFI_CHECK_FIRMWARE,  // report whether the module's firmware is up to date
+  WIFI_NO_MODULE,       // the WiFi module isn't responding: no notifications
+  WIFI_CONNECT,         // start a connection attempt
+  WIFI_CONNECTING,      // waiting for the link to come up
+  WIFI_RETRY_WAIT,      // the last attempt failed, waiting to try again
+  WIFI_CONNECTED
+};
+
+const unsigned long WIFI_STATUS_POLL_INTERVAL_MS = 500UL;
+const unsigned long WIFI_LINK_CHECK_INTERVAL_MS = 2000UL;
+const unsigned long WIFI_CONNECT_TIMEOUT_MS = 15000UL;
+const unsigned long WIFI_RETRY_MIN_DELAY_MS = 5000UL;
+const unsigned long WIFI_RETRY_MAX_DELAY_MS = 60000UL;
+const unsigned long WIFI_STATUS_LED_BLINK_MS = 500UL;
+
+WifiLinkState wifiLinkState = WIFI_START;
+unsigned long wifiStateTimestampMS = 0UL;  // when the current state began
+unsigned long wifiLastPollMS = 0UL;
+unsigned long wifiRetryDelayMS = WIFI_RETRY_MIN_DELAY_MS;
+
+inline void setWifiLinkState(WifiLinkState state, unsigned long loopNow) {
+  wifiLinkState = state;
+  wifiStateTimestampMS = loopNow;
+  wifiLastPollMS = loopNow;
 }
 
-#define playerTopic(leftPlayersTurn) (leftPlayersTurn ? TOPIC_LEFT : TOPIC_RIGHT)
+inline bool wifiLinkUp() {
+  return wifiLinkState == WIFI_CONNECTED;
+}
+
+/*
+ * Diagnostics
+ *
+ * What the link is doing is reported over Serial as it happens, a line at a
+ * time, through the Serial output queue (see clock-serial-out.h), since it can
+ * happen mid-game. Each of the link's details takes a round trip to the module
+ * to read back, so once connected, they're reported one per loopWifi() call,
+ * in place of that call's link step.
+ */
+enum WifiReportLine {
+  WIFI_REPORT_SSID,
+  WIFI_REPORT_BSSID,
+  WIFI_REPORT_RSSI,
+  WIFI_REPORT_IP,
+  WIFI_REPORT_MAC,
+  WIFI_REPORT_DONE
+};
+
+WifiReportLine wifiReportLine = WIFI_REPORT_DONE;
+
+inline void printWifiLine(const char* label, const char* value) {
+  serialMessageBegin(SERIAL_NOTIFICATIONS);
+  serialPrint(label);
+  serialPrint(value);
+  serialPrintln();
+  serialMessageEnd();
+}
 
-const int MSG_BUFFER_SIZE = 100;
-const int REQ_BUFFER_SIZE = 200;
+inline void serialPrintMacAddress(const byte mac[]) {
+  const char* HEX_DIGITS = "0123456789ABCDEF";
 
-inline void notifyNewGame(bool leftPlayersTurn, const char* label) {
-  if (wifiConnectionStatus != WL_CONNECTED ) {
-    wifiConnectionStatus = WiFi.status();
-    
-    if (wifiConnectionStatus != WL_CONNECTED) {
-      return;
+  for (byte i = 0; i < 6; i++) {
+    if (i > 0) {
+      serialPrint(":");
+    }
+    serialWrite((byte)HEX_DIGITS[mac[i] >> 4]);
+    serialWrite((byte)HEX_DIGITS[mac[i] & 0x0F]);
+  }
+}
+
+// the next line of the connected link's details, if there's one to report
+// (and nothing else waiting to go out): returns true if it took a step
+inline bool loopWifiReport() {
+  if (wifiReportLine == WIFI_REPORT_DONE || serialOutputPending()) {
+    return false;
+  }
+
+  byte mac[6];
+  serialMessageBegin(SERIAL_NOTIFICATIONS);
+
+  switch (wifiReportLine) {
+    case WIFI_REPORT_SSID:
+      serialPrint("SSID: ");
+      serialPrint(WiFi.SSID());
+      break;
+    case WIFI_REPORT_BSSID:
+      // AP/Router MAC
+      serialPrint("BSSID: ");
+      WiFi.BSSID(mac);
+      serialPrintMacAddress(mac);
+      break;
+    case WIFI_REPORT_RSSI: {
+      serialPrint("Signal Strength (RSSI): ");
+      long rssi = WiFi.RSSI();
+      if (rssi < 0) {
+        serialPrint("-");
+        rssi = -rssi;
+      }
+      serialPrintNumber(rssi);
+      break;
+    }
+    case WIFI_REPORT_IP: {
+      serialPrint("IP Address: ");
+      IPAddress ip = WiFi.localIP();
+      for (byte i = 0; i < 4; i++) {
+        if (i > 0) {
+          serialPrint(".");
+        }
+        serialPrintNumber(ip[i]);
+      }
+      break;
     }
+    default:
+      serialPrint("MAC Address: ");
+      WiFi.macAddress(mac);
+      serialPrintMacAddress(mac);
+      break;
   }
 
-  char msgBuffer[MSG_BUFFER_SIZE] = "";
-  char reqBuffer1[REQ_BUFFER_SIZE] = "";
-  char reqBuffer2[REQ_BUFFER_SIZE] = "";
+  serialPrintln();
+  serialMessageEnd();
+  wifiReportLine = (WifiReportLine)(wifiReportLine + 1);
+  return true;
+}
 
-  snprintf(msgBuffer, MSG_BUFFER_SIZE, NEW_GAME_MSG, label, playerString(leftPlayersTurn));
-  snprintf(reqBuffer1, REQ_BUFFER_SIZE, NTFY_REQUEST, TOPIC_LEFT, strlen(msgBuffer), CONN_KEEP_ALIVE, msgBuffer);
-  snprintf(reqBuffer2, REQ_BUFFER_SIZE, NTFY_REQUEST, TOPIC_RIGHT, strlen(msgBuffer), CONN_CLOSE, msgBuffer);
+inline void checkWifiFirmware() {
+  const char* fv = WiFi.firmwareVersion();
 
-  if (client.connect(NTFY_SERVER, NTFY_SERVER_PORT)) {
-    client.println(reqBuffer1);
-    client.println(reqBuffer2);
-    client.stop();
+  if (strcmp(fv, WIFI_FIRMWARE_LATEST_VERSION) < 0) {
+    printWifiLine("Please upgrade the WiFi module firmware. Current: ", fv);
+    printWifiLine("Latest: ", WIFI_FIRMWARE_LATEST_VERSION);
   } else {
-    wifiConnectionStatus = WiFi.status();
+    printWifiLine("WiFi module firmware is up-to-date: ", fv);
   }
 }
 
-inline void notifyPlayerTurn(bool leftPlayersTurn) {
-  if (wifiConnectionStatus != WL_CONNECTED ) {
-    wifiConnectionStatus = WiFi.status();
-    
-    if (wifiConnectionStatus != WL_CONNECTED) {
-      return;
-    }
+// the link has been found down (or never came up): wait for it again
+inline void wifiLinkLost(unsigned long loopNow) {
+  printWifiLine("WiFi connection lost! Status: ", statusCodeString(wifiConnectionStatus));
+
+  closeNtfyConnection();
+  wifiReportLine = WIFI_REPORT_DONE;
+  setWifiLinkState(WIFI_CONNECTING, loopNow);
+}
+
+// check the link now, rather than at the next poll (e.g. after a failed
+// connection to the ntfy server)
+inline bool checkWifiLink(unsigned long loopNow) {
+  if (!wifiLinkUp()) {
+    return false;
   }
 
-  char reqBuffer[REQ_BUFFER_SIZE] = "";
-  snprintf(reqBuffer, REQ_BUFFER_SIZE, NTFY_REQUEST, playerTopic(leftPlayersTurn), strlen(TURN_CHANGE_MSG), CONN_CLOSE, TURN_CHANGE_MSG);
+  wifiConnectionStatus = WiFi.status();
+  if (wifiConnectionStatus != WL_CONNECTED) {
+    wifiLinkLost(loopNow);
+    return false;
+  }
+
+  return true;
+}
 
-  if (client.connect(NTFY_SERVER, NTFY_SERVER_PORT)) {
-    client.println(reqBuffer);
-    client.stop();
+// polls the module every WIFI_STATUS_POLL_INTERVAL_MS while the link is
+// down: returns true once it's up
+inline bool pollWifiConnected(unsigned long loopNow) {
+  if (loopNow - wifiLastPollMS < WIFI_STATUS_POLL_INTERVAL_MS) {
+    return false;
+  }
+  wifiLastPollMS = loopNow;
+  wifiConnectionStatus = WiFi.status();
+
+  if (wifiConnectionStatus != WL_CONNECTED) {
+    return false;
+  }
+
+  printWifiLine("WiFi Connected!", "");
+  wifiReportLine = WIFI_REPORT_SSID;
+  wifiRetryDelayMS = WIFI_RETRY_MIN_DELAY_MS;
+  setWifiLinkState(WIFI_CONNECTED, loopNow);
+  return true;
+}
+
+inline void setupWifi() {
+  // WiFi.begin() only starts connecting (see above)
+  WiFi.setTimeout(0);
+  setWifiLinkState(WIFI_START, millis());
+}
+
+// one step per call: each of these is at most a few round trips to the module
+inline void loopWifi(unsigned long loopNow) {
+  if (loopWifiReport()) {
+    return;
+  }
+
+  switch (wifiLinkState) {
+    case WIFI_START:
+      wifiConnectionStatus = WiFi.status();
+
+      if (wifiConnectionStatus == WL_NO_MODULE) {
+        printWifiLine("Communication with WiFi module failed!", "");
+        setWifiLinkState(WIFI_NO_MODULE, loopNow);
+        return;
+      }
+
+      printWifiLine("WiFi module status: ", statusCodeString(wifiConnectionStatus));
+      setWifiLinkState(WIFI_CHECK_FIRMWARE, loopNow);
+      break;
+
+    case WIFI_CHECK_FIRMWARE:
+      checkWifiFirmware();
+      setWifiLinkState(WIFI_CONNECT, loopNow);
+      break;
+
+    case WIFI_NO_MODULE:
+      break;
+
+    case WIFI_CONNECT:
+      printWifiLine("Attempting to connect to SSID: ", SSID);
+      wifiConnectionStatus = WiFi.begin(SSID, PASS);
+      setWifiLinkState(WIFI_CONNECTING, loopNow);
+      break;
+
+    case WIFI_CONNECTING:
+      if (!pollWifiConnected(loopNow) && loopNow - wifiStateTimestampMS >= WIFI_CONNECT_TIMEOUT_MS) {
+        printWifiLine("Error connecting to WiFi network! Status: ", statusCodeString(wifiConnectionStatus));
+        setWifiLinkState(WIFI_RETRY_WAIT, loopNow);
+      }
+      break;
+
+    case WIFI_RETRY_WAIT:
+      // (the module may still get there on its own)
+      if (!pollWifiConnected(loopNow) && loopNow - wifiStateTimestampMS >= wifiRetryDelayMS) {
+        wifiRetryDelayMS = min(wifiRetryDelayMS * 2, WIFI_RETRY_MAX_DELAY_MS);
+        setWifiLinkState(WIFI_CONNECT, loopNow);
+      }
+      break;
+
+    case WIFI_CONNECTED:
+      if (loopNow - wifiLastPollMS >= WIFI_LINK_CHECK_INTERVAL_MS) {
+        wifiLastPollMS = loopNow;
+        checkWifiLink(loopNow);
+      }
+      break;
+  }
+}
+
+// button LEDs while idle: off once connected, alternating while connecting,
+// blinking together while waiting to retry, and both on if there's no module
+inline void wifiStatusLEDs(unsigned long loopNow, bool& left, bool& right) {
+  bool blinkOn = (loopNow / WIFI_STATUS_LED_BLINK_MS) & 1;
+
+  switch (wifiLinkState) {
+    case WIFI_CONNECTED:
+      left = false;
+      right = false;
+      break;
+    case WIFI_NO_MODULE:
+      left = true;
+      right = true;
+      break;
+    case WIFI_RETRY_WAIT:
+      left = blinkOn;
+      right = blinkOn;
+      break;
+    default:
+      left = blinkOn;
+      right = !blinkOn;
+      break;
+  }
+}
+
+/*
+ * Notification outbox
+ *
+ * The notify*() functions only queue an event and return immediately. The
+ * actual HTTP requests are sent by loopNotificationOutbox() (called from
+ * loopHardware()), which advances through connect and send one small step
+ * per loop iteration, so the multiplexer and buttons keep running while a
+ * notification is in flight.
+ *
+ * A request is never formatted as a whole. It's kept as a list of fragments:
+ * the constant strings above (in flash) and the topic, label & player name
+ * strings, all by pointer, plus the Content-Length digits, the only piece
+ * that's formatted. Each write copies the next chunk's worth of fragments
+ * into a small staging buffer, so the module still sees one write per chunk.
+ */
+const byte NOTIFICATION_OUTBOX_CAPACITY = 8; // must be a power of 2
+const int NOTIFICATION_WRITE_CHUNK_BYTES = 64;
+const byte REQUEST_MAX_FRAGMENTS = 12;
+const byte CONTENT_LENGTH_DIGITS = 6;
+
+enum OutboxState { OUTBOX_IDLE, OUTBOX_CONNECT, OUTBOX_SEND };
+
+typedef struct {
+  NotificationType type;
+  bool leftPlayersTurn;
+  const char* label;
+} PendingNotification;
+
+PendingNotification notificationOutbox[NOTIFICATION_OUTBOX_CAPACITY];
+byte notificationOutboxHead = 0;
+byte notificationOutboxTail = 0;
+unsigned int notificationsDropped = 0; // reported in the INSTR dump
+
+OutboxState outboxState = OUTBOX_IDLE;
+bool outboxRetried = false;
+byte outboxRequestIndex = 0;
+
+const char* outboxFragments[REQUEST_MAX_FRAGMENTS];
+byte outboxFragmentCount = 0;
+// the send position: the next fragment & the offset into it
+byte outboxFragment = 0;
+unsigned int outboxFragmentOffset = 0;
+char outboxContentLength[CONTENT_LENGTH_DIGITS];
+uint8_t outboxChunk[NOTIFICATION_WRITE_CHUNK_BYTES];
+
+inline PendingNotification& outboxFront() {
+  return notificationOutbox[notificationOutboxTail & (NOTIFICATION_OUTBOX_CAPACITY - 1)];
+}
+
+// new game & timeout messages go to both players (pipelined, without waiting
+// for the first response)
+inline byte outboxRequestCount(NotificationType type) {
+  return type == PLAYER_TURN ? 1 : 2;
+}
+
+inline void queueNotification(NotificationType type, bool leftPlayersTurn, const char* label) {
+  #if defined(SERIAL_BUTTON_INPUT)
+    // test builds: echo each event in the Uno's format, so that
+    // tools/notification-latency.mjs knows which requests to expect
+    printNotificationLine(type, leftPlayersTurn, label);
+  #endif
+
+  if ((byte)(notificationOutboxHead - notificationOutboxTail) == NOTIFICATION_OUTBOX_CAPACITY) {
+    notificationsDropped++;
+    return;
+  }
+
+  notificationOutbox[notificationOutboxHead & (NOTIFICATION_OUTBOX_CAPACITY - 1)] = { type, leftPlayersTurn, label };
+  notificationOutboxHead++;
+}
+
+inline void addOutboxFragment(const char* fragment) {
+  if (outboxFragmentCount < REQUEST_MAX_FRAGMENTS) {
+    outboxFragments[outboxFragmentCount++] = fragment;
+  }
+}
+
+inline void buildOutboxRequest() {
+  const PendingNotification& n = outboxFront();
+  const char* topic = playerTopic(n.leftPlayersTurn);
+
+  if (n.type != PLAYER_TURN) {
+    topic = outboxRequestIndex == 0 ? TOPIC_LEFT : TOPIC_RIGHT;
+  }
+
+  outboxFragmentCount = 0;
+  addOutboxFragment(NTFY_REQUEST_POST);
+  addOutboxFragment(topic);
+  addOutboxFragment(NTFY_REQUEST_HOST);
+  addOutboxFragment(NTFY_SERVER);
+  addOutboxFragment(NTFY_REQUEST_LENGTH);
+  addOutboxFragment(outboxContentLength);
+  addOutboxFragment(NTFY_REQUEST_BODY);
+
+  byte bodyStart = outboxFragmentCount;
+
+  if (n.type == NEW_GAME) {
+    addOutboxFragment(NEW_GAME_MSG);
+    addOutboxFragment(n.label);
+    addOutboxFragment(NEW_GAME_MSG_PLAYER);
+    addOutboxFragment(playerString(n.leftPlayersTurn));
+  } else if (n.type == TIMEOUT) {
+    addOutboxFragment(TIMEOUT_MSG);
+    addOutboxFragment(playerString(n.leftPlayersTurn));
+    addOutboxFragment(TIMEOUT_MSG_END);
   } else {
-    wifiConnectionStatus = WiFi.status();
+    addOutboxFragment(TURN_CHANGE_MSG);
   }
+
+  unsigned int contentLength = 0;
+  for (byte i = bodyStart; i < outboxFragmentCount; i++) {
+    contentLength += strlen(outboxFragments[i]);
+  }
+  utoa(contentLength, outboxContentLength, 10);
+
+  outboxFragment = 0;
+  outboxFragmentOffset = 0;
 }
 
-inline void notifyTimeout(bool leftPlayersTurn) {
-  if (wifiConnectionStatus != WL_CONNECTED ) {
-    wifiConnectionStatus = WiFi.status();
-    
-    if (wifiConnectionStatus != WL_CONNECTED) {
+// copy up to a chunk of the request, from the send position on, into
+// outboxChunk (without moving the send position)
+inline int stageOutboxChunk() {
+  int length = 0;
+  byte fragment = outboxFragment;
+  unsigned int offset = outboxFragmentOffset;
+
+  while (fragment < outboxFragmentCount && length < NOTIFICATION_WRITE_CHUNK_BYTES) {
+    char c = outboxFragments[fragment][offset];
+
+    if (c == '\0') {
+      fragment++;
+      offset = 0;
+    } else {
+      outboxChunk[length++] = c;
+      offset++;
+    }
+  }
+
+  return length;
+}
+
+// move the send position on by however much was actually written
+inline void advanceOutboxFragments(size_t written) {
+  while (written > 0 && outboxFragment < outboxFragmentCount) {
+    unsigned int remaining = strlen(outboxFragments[outboxFragment] + outboxFragmentOffset);
+
+    if (written < remaining) {
+      outboxFragmentOffset += written;
       return;
     }
+
+    written -= remaining;
+    outboxFragment++;
+    outboxFragmentOffset = 0;
   }
 
-  char msgBuffer[MSG_BUFFER_SIZE] = "";
-  char reqBuffer1[REQ_BUFFER_SIZE] = "";
-  char reqBuffer2[REQ_BUFFER_SIZE] = "";
+  // skip over any empty fragments, so a finished request is noticed
+  while (outboxFragment < outboxFragmentCount && outboxFragments[outboxFragment][outboxFragmentOffset] == '\0') {
+    outboxFragment++;
+    outboxFragmentOffset = 0;
+  }
+}
 
-  snprintf(msgBuffer, MSG_BUFFER_SIZE, TIMEOUT_MSG, playerString(leftPlayersTurn));
-  snprintf(reqBuffer1, REQ_BUFFER_SIZE, NTFY_REQUEST, TOPIC_LEFT, strlen(msgBuffer), CONN_KEEP_ALIVE, msgBuffer);
-  snprintf(reqBuffer2, REQ_BUFFER_SIZE, NTFY_REQUEST, TOPIC_RIGHT, strlen(msgBuffer), CONN_CLOSE, msgBuffer);
+inline void finishOutboxNotification() {
+  notificationOutboxTail++;
+  outboxState = OUTBOX_IDLE;
+}
 
-  if (client.connect(NTFY_SERVER, NTFY_SERVER_PORT)) {
-    client.println(reqBuffer1);
-    client.println(reqBuffer2);
-    client.stop();
-  } else {
-    wifiConnectionStatus = WiFi.status();
+inline void loopNotificationOutbox(unsigned long loopNow) {
+  loopNtfyConnection(loopNow);
+
+  switch (outboxState) {
+    case OUTBOX_IDLE:
+      // notifications wait for the link (see loopWifi())
+      if (notificationOutboxHead == notificationOutboxTail || !wifiLinkUp()) {
+        return;
+      }
+
+      outboxRequestIndex = 0;
+      outboxRetried = false;
+      buildOutboxRequest();
+      outboxState = ntfyConnected ? OUTBOX_SEND : OUTBOX_CONNECT;
+      break;
+
+    case OUTBOX_CONNECT:
+      if (openNtfyConnection()) {
+        outboxState = OUTBOX_SEND;
+      } else if (!checkWifiLink(loopNow)) {
+        // try again (from its first request) once the link is back
+        outboxState = OUTBOX_IDLE;
+      } else {
+        notificationsDropped++;
+        finishOutboxNotification();
+      }
+      break;
+
+    case OUTBOX_SEND: {
+      int chunk = stageOutboxChunk();
+      size_t written = client.write(outboxChunk, chunk);
+
+      if (written == 0) {
+        // the connection went away (possibly while it sat idle): reconnect &
+        // resend the current request once, before giving up on it
+        closeNtfyConnection();
+
+        if (outboxRetried) {
+          notificationsDropped++;
+          finishOutboxNotification();
+        } else {
+          outboxRetried = true;
+          outboxFragment = 0;
+          outboxFragmentOffset = 0;
+          outboxState = OUTBOX_CONNECT;
+        }
+        break;
+      }
+
+      advanceOutboxFragments(written);
+
+      if (outboxFragment >= outboxFragmentCount) {
+        outboxRequestIndex++;
+
+        if (outboxRequestIndex < outboxRequestCount(outboxFront().type)) {
+          buildOutboxRequest();
+        } else {
+          // leave the connection open for the next notification
+          finishOutboxNotification();
+        }
+      }
+      break;
+    }
   }
 }
 
+inline void notifyNewGame(bool leftPlayersTurn, const char* label) {
+  queueNotification(NEW_GAME, leftPlayersTurn, label);
+}
+
+inline void notifyPlayerTurn(bool leftPlayersTurn) {
+  queueNotification(PLAYER_TURN, leftPlayersTurn, NO_LABEL);
+}
+
+inline void notifyTimeout(bool leftPlayersTurn) {
+  queueNotification(TIMEOUT, leftPlayersTurn, NO_LABEL);
+}
+
 #endif _CLOCK_WIFI_H
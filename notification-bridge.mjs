@@ -1,6 +1,4 @@
-import { SerialPort } from 'serialport';
-import { autoDetect } from '@serialport/bindings-cpp';
-import { ReadlineParser } from '@serialport/parser-readline';
+import { ClockStreamDecoder, decodeMoveLogLine, decodeNotificationLine, decodeSerialStatsLine } from './notification-protocol.mjs';
 
 const DT_FORMATTER = Intl.DateTimeFormat(undefined, { dateStyle: 'short', timeStyle: 'long' });
 
@@ -8,18 +6,21 @@ const ARDUINO_SERIAL_PORT = process.env.ARDUINO_SERIAL_PORT;
 const ARDUINO_SERIAL_PORT_SPEED = Number(process.env.ARDUINO_SERIAL_PORT_SPEED);
 const TOPIC_LEFT = process.env.TOPIC_LEFT;
 const TOPIC_RIGHT = process.env.TOPIC_RIGHT;
+const NTFY_SERVER_URL = process.env.NTFY_SERVER_URL ?? 'https://ntfy.sh';
 const DRY_RUN = process.env.DRY_RUN ? process.env.DRY_RUN.toLowerCase() === 'true' : false;
 const DEBUG = process.env.DEBUG ? process.env.DEBUG.toLowerCase() === 'true' : false;
+const STREAM_STATS_INTERVAL_MS = 60000;
 
 /*
  * Internal Functions
  */
 const notify = (topic, message) => {
     if (DRY_RUN) {
-        log(`DRY RUN - NOT POSTing to ntfy.sh on [${topic}]:`, message);
+        log(`DRY RUN - NOT POSTing to ${NTFY_SERVER_URL} on [${topic}]:`, message);
     } else {
-        fetch(`https://ntfy.sh/${topic}`, { method: 'POST', body: message });
-        log(`POSTing to ntfy.sh on [${topic}]:`, message);
+        fetch(`${NTFY_SERVER_URL}/${topic}`, { method: 'POST', body: message })
+            .catch(err => log(`Error POSTing to ${NTFY_SERVER_URL} on [${topic}]:`, err.message));
+        log(`POSTing to ${NTFY_SERVER_URL} on [${topic}]:`, message);
     }
 };
 
@@ -35,9 +36,50 @@ const notifyNewGame = (leftPlayersTurn, timerOption) => notifyBoth(`New Game Sta
 const notifyPlayerTurn = leftPlayersTurn => notify(topic(leftPlayersTurn), 'Your Move!');
 const notifyTimeout = leftPlayersTurn => notifyBoth(`Game Over! ${player(leftPlayersTurn)} Timed Out`);
 
+const handleNotification = ({ notificationType, leftPlayersTurn, label }) => {
+    switch (notificationType) {
+        case 0:
+            notifyNewGame(leftPlayersTurn, label);
+            break;
+        case 1:
+            notifyPlayerTurn(leftPlayersTurn);
+            break;
+        case 2:
+            notifyTimeout(leftPlayersTurn);
+            break;
+    }
+};
+
+const logMoves = ({ label, firstMove, firstMoverLeft, movesMS }) => {
+    log(`Move Log (${label}, ${movesMS.length} moves):`);
+    movesMS.forEach((ms, i) => {
+        const leftMoved = firstMoverLeft === (i % 2 === 0);
+        console.log(`  ${firstMove + i}. ${player(leftMoved)}: ${(ms / 1000).toFixed(2)}s`);
+    });
+};
+
+// frame & line losses, on both ends of the serial link: logged whenever they've
+// changed since the last check (and every time, with DEBUG)
+let clockFramesSkipped = 0;
+let lastStreamLossCount = 0;
+
+const logStreamStats = () => {
+    const { frames, badFrames, missedFrames, longLines } = decoder.stats;
+    const lossCount = missedFrames + badFrames + longLines + clockFramesSkipped;
+    const summary = `${frames} frames received, ${missedFrames} missed, ${badFrames} bad, ${longLines} overlong lines dropped, ${clockFramesSkipped} skipped by the clock`;
+
+    if (lossCount !== lastStreamLossCount) {
+        log(`WARNING: serial stream losses: ${summary}`);
+        lastStreamLossCount = lossCount;
+    } else if (DEBUG) {
+        log(`DEBUG: serial stream: ${summary}`);
+    }
+};
+
 const log = (message, ...rest) => console.log(`${DT_FORMATTER.format(new Date())}: ${message}`, ...rest);
 
 const listPorts = async () => {
+    const { autoDetect } = await import('@serialport/bindings-cpp');
     const Binding = autoDetect();
     const ports = await Binding.list();
 
@@ -52,47 +94,71 @@ const listPorts = async () => {
 console.log(`Arduinix Chess Clock ${process.env.npm_package_version} - Notification Bridge
   Serial Port: ${ARDUINO_SERIAL_PORT}
   Serial Port Speed: ${ARDUINO_SERIAL_PORT_SPEED}
+  NTFY Server: ${NTFY_SERVER_URL}
   Left Player NTFY Topic: ${TOPIC_LEFT}
   Right Player NTFY Topic: ${TOPIC_RIGHT}
   Dry Run: ${DRY_RUN}
 `);
 
-const port = new SerialPort({ path: ARDUINO_SERIAL_PORT, baudRate: ARDUINO_SERIAL_PORT_SPEED });
-const parser = port.pipe(new ReadlineParser({ delimiter: '\n' }));
+const decoder = new ClockStreamDecoder({
+    onLine: line => {
+        if (DEBUG) {
+            log('DEBUG:', line);
+        }
 
-port.on('error', async err => {
-    log(`Error Opening Arduino Serial Port at ${ARDUINO_SERIAL_PORT} (${ARDUINO_SERIAL_PORT_SPEED} baud):`, err);
-    listPorts();
-});
-port.on('close', err => {
-    log(`Arduino Serial Port Closed: ${ARDUINO_SERIAL_PORT}`);
-});
-port.on('open', () => {
-  log(`Arduino Serial Port Opened: ${ARDUINO_SERIAL_PORT} (${ARDUINO_SERIAL_PORT_SPEED} baud)`);
-});
+        const notification = decodeNotificationLine(line);
+        if (notification) {
+            handleNotification(notification);
+        }
 
-parser.on('data', data =>{
-    if (DEBUG) {
-        log('DEBUG:', data);
-    }
+        const moveLog = decodeMoveLogLine(line);
+        if (moveLog) {
+            logMoves(moveLog);
+        }
 
-    if (data.startsWith("CCNTFY,")) {
-        const parts = data.split(',');
-        if (parts.length === 4) {
-            const [msgType, notificationType, leftPlayersTurn, timerLabel] = parts;
-            const isLeft = leftPlayersTurn === '1';
-
-            switch (notificationType) {
-                case '0':
-                    notifyNewGame(isLeft, timerLabel);
-                    break;
-                case '1':
-                    notifyPlayerTurn(isLeft);
-                    break;
-                case '2':
-                    notifyTimeout(isLeft);
-                    break;
-            }
+        const serialStats = decodeSerialStatsLine(line);
+        if (serialStats?.notificationBytesDropped) {
+            log(`WARNING: the clock dropped ${serialStats.notificationBytesDropped} bytes of notifications (Serial output queue full)`);
         }
-    }
+    },
+    onFrame: frame => {
+        if (DEBUG && frame.kind !== 'status') {
+            log('DEBUG:', frame);
+        }
+
+        if (frame.kind === 'notification') {
+            handleNotification(frame);
+        } else if (frame.kind === 'status' && frame.framesSkipped !== undefined) {
+            clockFramesSkipped = frame.framesSkipped;
+        }
+    },
 });
+
+setInterval(logStreamStats, STREAM_STATS_INTERVAL_MS).unref();
+
+// ARDUINO_SERIAL_PORT=- reads the clock's output from stdin instead, e.g. piped
+// from the host simulation (see sim/clock-sim.cpp), which also doesn't need the
+// serialport package (or its native bindings) installed
+if (ARDUINO_SERIAL_PORT === '-') {
+    process.stdin.on('data', chunk => decoder.push(chunk));
+    process.stdin.on('end', () => {
+        log('Clock Input Closed: stdin');
+        logStreamStats();
+    });
+} else {
+    const { SerialPort } = await import('serialport');
+    const port = new SerialPort({ path: ARDUINO_SERIAL_PORT, baudRate: ARDUINO_SERIAL_PORT_SPEED });
+
+    port.on('error', async err => {
+        log(`Error Opening Arduino Serial Port at ${ARDUINO_SERIAL_PORT} (${ARDUINO_SERIAL_PORT_SPEED} baud):`, err);
+        listPorts();
+    });
+    port.on('close', err => {
+        log(`Arduino Serial Port Closed: ${ARDUINO_SERIAL_PORT}`);
+    });
+    port.on('open', () => {
+      log(`Arduino Serial Port Opened: ${ARDUINO_SERIAL_PORT} (${ARDUINO_SERIAL_PORT_SPEED} baud)`);
+    });
+
+    port.on('data', chunk => decoder.push(chunk));
+}
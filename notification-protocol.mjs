@@ -0,0 +1,218 @@
+/*
+ * Arduinix Chess Clock serial protocol decoder.
+ *
+ * The clock's serial stream carries text lines (CCNTFY notifications, status
+ * lines and log output), and when built with CLOCK_BINARY_TELEMETRY, binary
+ * frames (see clock-telemetry.h):
+ *
+ *   0xA5 | type | seq | len | payload (len bytes) | CRC-16/CCITT-FALSE (LE)
+ *
+ * ClockStreamDecoder splits a raw byte stream into both, so they can be
+ * handled side by side.
+ */
+
+export const TELEMETRY_SYNC = 0xA5;
+export const TELEMETRY_FRAME_STATUS = 0x01;
+export const TELEMETRY_FRAME_NOTIFICATION = 0x02;
+
+const HEADER_SIZE = 4;
+const CRC_SIZE = 2;
+const MAX_PAYLOAD_SIZE = 32;
+const MAX_LINE_LENGTH = 256;
+// a CCMOVES dump is one line for the whole game: a full ring (see
+// clock-move-log.h) is at most 384 moves of up to 10 digits each
+const MAX_MOVE_LOG_LINE_LENGTH = 8192;
+const MOVE_LOG_PREFIX = Buffer.from('CCMOVES,', 'latin1');
+
+const FLAG_LEFT_PLAYERS_TURN = 1 << 0;
+
+export const CLOCK_STATES = ['IDLE', 'RUNNING', 'TIMEOUT', 'MENU', 'BRIGHTNESS'];
+
+export const crc16 = (bytes, crc = 0xFFFF) => {
+    for (const b of bytes) {
+        crc ^= b << 8;
+        for (let i = 0; i < 8; i++) {
+            crc = crc & 0x8000 ? ((crc << 1) ^ 0x1021) & 0xFFFF : (crc << 1) & 0xFFFF;
+        }
+    }
+    return crc;
+};
+
+const decodeStatus = payload => ({
+    clockState: CLOCK_STATES[payload.readUInt8(0)] ?? payload.readUInt8(0),
+    option: payload.readUInt8(1),
+    leftPlayersTurn: (payload.readUInt8(2) & FLAG_LEFT_PLAYERS_TURN) !== 0,
+    elapsedMS: payload.readUInt32LE(3),
+    remainingMS: payload.readUInt32LE(7),
+    leftBankMS: payload.readUInt32LE(11),
+    rightBankMS: payload.readUInt32LE(15),
+    // (not sent by older builds)
+    framesSkipped: payload.length >= 21 ? payload.readUInt16LE(19) : undefined,
+});
+
+const decodeNotification = payload => ({
+    notificationType: payload.readUInt8(0),
+    leftPlayersTurn: (payload.readUInt8(1) & FLAG_LEFT_PLAYERS_TURN) !== 0,
+    label: payload.subarray(2).toString('latin1'),
+});
+
+export const decodeFrame = (type, payload) => {
+    if (type === TELEMETRY_FRAME_STATUS && payload.length >= 19) {
+        return { kind: 'status', ...decodeStatus(payload) };
+    } else if (type === TELEMETRY_FRAME_NOTIFICATION && payload.length >= 2) {
+        return { kind: 'notification', ...decodeNotification(payload) };
+    }
+    return { kind: 'unknown', type, payload };
+};
+
+// Parses a legacy CCNTFY text line, or returns null for any other line.
+export const decodeNotificationLine = line => {
+    if (!line.startsWith('CCNTFY,')) {
+        return null;
+    }
+
+    const parts = line.split(',');
+    if (parts.length !== 4) {
+        return null;
+    }
+
+    const [msgType, notificationType, leftPlayersTurn, label] = parts;
+    return {
+        kind: 'notification',
+        notificationType: Number(notificationType),
+        leftPlayersTurn: leftPlayersTurn === '1',
+        label,
+    };
+};
+
+// Parses a CCMOVES move log dump (see clock-move-log.h), or returns null for
+// any other line. Moves are numbered from firstMove & alternate between players.
+export const decodeMoveLogLine = line => {
+    if (!line.startsWith('CCMOVES,')) {
+        return null;
+    }
+
+    const [msgType, label, firstMove, firstMover, ...moves] = line.split(',');
+    return {
+        kind: 'moveLog',
+        label,
+        firstMove: Number(firstMove),
+        firstMoverLeft: firstMover === 'L',
+        movesMS: moves.map(cs => Number(cs) * 10),
+    };
+};
+
+// Parses a CCSERIAL output scheduler report (see clock-serial-out.h), or
+// returns null for any other line. The counts are totals since power on.
+export const decodeSerialStatsLine = line => {
+    if (!line.startsWith('CCSERIAL,')) {
+        return null;
+    }
+
+    const [msgType, notificationBytesDropped, statusBytesDropped, bytesDeferred] = line.split(',').map(Number);
+    return {
+        kind: 'serialStats',
+        notificationBytesDropped,
+        statusBytesDropped,
+        bytesDeferred,
+    };
+};
+
+export class ClockStreamDecoder {
+    constructor({ onLine = () => {}, onFrame = () => {} } = {}) {
+        this.onLine = onLine;
+        this.onFrame = onFrame;
+        this.buffer = Buffer.alloc(0);
+        this.line = [];
+        this.lastSeq = null;
+        this.lineTooLong = false;
+        this.stats = { frames: 0, badFrames: 0, missedFrames: 0, longLines: 0 };
+    }
+
+    push(chunk) {
+        this.buffer = this.buffer.length ? Buffer.concat([this.buffer, chunk]) : chunk;
+
+        let i = 0;
+        while (i < this.buffer.length) {
+            const b = this.buffer[i];
+
+            // text is plain ASCII, so a sync byte can only be the start of a frame
+            if (b === TELEMETRY_SYNC) {
+                if (this.buffer.length - i < HEADER_SIZE) {
+                    break;
+                }
+
+                const length = this.buffer[i + 3];
+                const frameSize = HEADER_SIZE + length + CRC_SIZE;
+                if (length <= MAX_PAYLOAD_SIZE) {
+                    if (this.buffer.length - i < frameSize) {
+                        break;
+                    }
+
+                    const frame = this.buffer.subarray(i, i + frameSize);
+                    const crc = frame.readUInt16LE(HEADER_SIZE + length);
+                    if (crc16(frame.subarray(1, HEADER_SIZE + length)) === crc) {
+                        // frames are never sent mid-line: anything pending is
+                        // left over from a corrupted frame
+                        this.line = [];
+                        this.lineTooLong = false;
+                        this.emitFrame(frame[1], frame[2], frame.subarray(HEADER_SIZE, HEADER_SIZE + length));
+                        i += frameSize;
+                        continue;
+                    }
+                }
+
+                // not a valid frame: skip the sync byte and resynchronise
+                this.stats.badFrames++;
+                i++;
+                continue;
+            }
+
+            i++;
+            if (b === 0x0A) {
+                this.emitLine();
+            } else if (b === 0x0D) {
+                continue;
+            } else if (this.line.length < this.maxLineLength()) {
+                this.line.push(b);
+            } else {
+                this.lineTooLong = true;
+            }
+        }
+
+        this.buffer = this.buffer.subarray(i);
+    }
+
+    maxLineLength() {
+        if (this.line.length < MAX_LINE_LENGTH) {
+            return MAX_LINE_LENGTH;
+        }
+
+        const isMoveLog = MOVE_LOG_PREFIX.every((b, i) => this.line[i] === b);
+        return isMoveLog ? MAX_MOVE_LOG_LINE_LENGTH : MAX_LINE_LENGTH;
+    }
+
+    // a line cut short would decode to garbage, so it's counted & dropped instead
+    emitLine() {
+        const text = Buffer.from(this.line).toString('latin1');
+        const tooLong = this.lineTooLong;
+        this.line = [];
+        this.lineTooLong = false;
+
+        if (tooLong) {
+            this.stats.longLines++;
+            return;
+        }
+        this.onLine(text);
+    }
+
+    emitFrame(type, seq, payload) {
+        if (this.lastSeq !== null) {
+            this.stats.missedFrames += (seq - this.lastSeq - 1) & 0xFF;
+        }
+        this.lastSeq = seq;
+        this.stats.frames++;
+
+        this.onFrame({ seq, ...decodeFrame(type, payload) });
+    }
+}
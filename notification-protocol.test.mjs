@@ -0,0 +1,147 @@
+import assert from 'node:assert/strict';
+import { test } from 'node:test';
+
+import {
+    ClockStreamDecoder,
+    TELEMETRY_FRAME_NOTIFICATION,
+    TELEMETRY_FRAME_STATUS,
+    TELEMETRY_SYNC,
+    crc16,
+    decodeMoveLogLine,
+} from './notification-protocol.mjs';
+
+const decodeLines = text => {
+    const lines = [];
+    const decoder = new ClockStreamDecoder({ onLine: line => lines.push(line) });
+    decoder.push(Buffer.from(text, 'latin1'));
+    return { lines, decoder };
+};
+
+test('a move log dump longer than a normal line decodes whole', () => {
+    const movesCS = Array.from({ length: 200 }, (_, i) => 100 + i * 37);
+    const dump = `CCMOVES,3+2,1,L,${movesCS.join(',')}`;
+    assert.ok(dump.length > 256);
+
+    const { lines } = decodeLines(`${dump}\r\nCCNTFY,1,0,-\r\n`);
+    assert.equal(lines.length, 2);
+
+    const moveLog = decodeMoveLogLine(lines[0]);
+    assert.equal(moveLog.label, '3+2');
+    assert.equal(moveLog.firstMove, 1);
+    assert.equal(moveLog.firstMoverLeft, true);
+    assert.deepEqual(moveLog.movesMS, movesCS.map(cs => cs * 10));
+});
+
+test('other overlong lines are dropped, not cut short', () => {
+    const { lines, decoder } = decodeLines(`CCNTFY,${'x'.repeat(300)}\r\nCCNTFY,2,1,-\r\n`);
+    assert.deepEqual(lines, ['CCNTFY,2,1,-']);
+    assert.equal(decoder.stats.longLines, 1);
+});
+
+// a telemetry frame as the clock sends it (see clock-telemetry.h)
+const telemetryFrame = (type, seq, payload) => {
+    const body = Buffer.from([type, seq, payload.length, ...payload]);
+    const crc = Buffer.alloc(2);
+    crc.writeUInt16LE(crc16(body));
+    return Buffer.concat([Buffer.from([TELEMETRY_SYNC]), body, crc]);
+};
+
+const statusPayload = ({ clockState, option, leftPlayersTurn, elapsedMS, remainingMS, leftBankMS, rightBankMS, framesSkipped }) => {
+    const payload = Buffer.alloc(21);
+    payload.writeUInt8(clockState, 0);
+    payload.writeUInt8(option, 1);
+    payload.writeUInt8(leftPlayersTurn ? 1 : 0, 2);
+    payload.writeUInt32LE(elapsedMS, 3);
+    payload.writeUInt32LE(remainingMS, 7);
+    payload.writeUInt32LE(leftBankMS, 11);
+    payload.writeUInt32LE(rightBankMS, 15);
+    payload.writeUInt16LE(framesSkipped, 19);
+    return payload;
+};
+
+const notificationPayload = (notificationType, leftPlayersTurn, label) =>
+    Buffer.from([notificationType, leftPlayersTurn ? 1 : 0, ...Buffer.from(label, 'latin1')]);
+
+const decodeChunks = chunks => {
+    const lines = [];
+    const frames = [];
+    const decoder = new ClockStreamDecoder({ onLine: line => lines.push(line), onFrame: frame => frames.push(frame) });
+    chunks.forEach(chunk => decoder.push(typeof chunk === 'string' ? Buffer.from(chunk, 'latin1') : chunk));
+    return { lines, frames, decoder };
+};
+
+test('the frame CRC is CRC-16/CCITT-FALSE', () => {
+    assert.equal(crc16(Buffer.from('123456789', 'latin1')), 0x29B1);
+    assert.equal(crc16(Buffer.alloc(0)), 0xFFFF);
+});
+
+test('status & notification frames decode between text lines', () => {
+    const status = {
+        clockState: 1, option: 8, leftPlayersTurn: true, elapsedMS: 12345,
+        remainingMS: 167655, leftBankMS: 180000, rightBankMS: 176000, framesSkipped: 3,
+    };
+    const { lines, frames, decoder } = decodeChunks([
+        'CCNTFY,0,1,3+2\r\n',
+        telemetryFrame(TELEMETRY_FRAME_STATUS, 7, statusPayload(status)),
+        telemetryFrame(TELEMETRY_FRAME_NOTIFICATION, 8, notificationPayload(1, false, '-')),
+        'CCNTFY,1,0,-\r\n',
+    ]);
+
+    assert.deepEqual(lines, ['CCNTFY,0,1,3+2', 'CCNTFY,1,0,-']);
+    assert.deepEqual(frames, [
+        { seq: 7, kind: 'status', ...status, clockState: 'RUNNING' },
+        { seq: 8, kind: 'notification', notificationType: 1, leftPlayersTurn: false, label: '-' },
+    ]);
+    assert.deepEqual(decoder.stats, { frames: 2, badFrames: 0, missedFrames: 0, longLines: 0 });
+});
+
+test('a frame split across reads decodes once it is whole', () => {
+    const frame = telemetryFrame(TELEMETRY_FRAME_NOTIFICATION, 1, notificationPayload(0, true, '5+3'));
+    const { frames } = decodeChunks([...frame].map(b => Buffer.from([b])));
+
+    assert.deepEqual(frames, [{ seq: 1, kind: 'notification', notificationType: 0, leftPlayersTurn: true, label: '5+3' }]);
+});
+
+test('a frame with a bad CRC is dropped, and the decoder resynchronises', () => {
+    const corrupt = telemetryFrame(TELEMETRY_FRAME_NOTIFICATION, 2, notificationPayload(1, true, '-'));
+    corrupt[corrupt.length - 1] ^= 0xFF;
+
+    const { lines, frames, decoder } = decodeChunks([
+        telemetryFrame(TELEMETRY_FRAME_NOTIFICATION, 1, notificationPayload(1, false, '-')),
+        corrupt,
+        telemetryFrame(TELEMETRY_FRAME_NOTIFICATION, 3, notificationPayload(2, true, '-')),
+        'CCNTFY,1,0,-\r\n',
+    ]);
+
+    assert.deepEqual(frames.map(frame => frame.seq), [1, 3]);
+    assert.deepEqual(lines, ['CCNTFY,1,0,-']);
+    assert.equal(decoder.stats.badFrames, 1);
+    // the corrupt frame's sequence number is missing from those decoded
+    assert.equal(decoder.stats.missedFrames, 1);
+});
+
+test('a truncated frame is dropped, and the next frame & line decode', () => {
+    const truncated = telemetryFrame(TELEMETRY_FRAME_STATUS, 20, statusPayload({
+        clockState: 1, option: 0, leftPlayersTurn: false, elapsedMS: 1000,
+        remainingMS: 2000, leftBankMS: 3000, rightBankMS: 4000, framesSkipped: 0,
+    })).subarray(0, 12);
+
+    const { lines, frames, decoder } = decodeChunks([
+        truncated,
+        telemetryFrame(TELEMETRY_FRAME_NOTIFICATION, 21, notificationPayload(2, false, '-')),
+        'CCNTFY,2,0,-\r\n',
+    ]);
+
+    assert.deepEqual(frames, [{ seq: 21, kind: 'notification', notificationType: 2, leftPlayersTurn: false, label: '-' }]);
+    assert.deepEqual(lines, ['CCNTFY,2,0,-']);
+    assert.equal(decoder.stats.badFrames, 1);
+    assert.equal(decoder.stats.missedFrames, 0);
+});
+
+test('gaps in the sequence number count as missed frames, across its wraparound', () => {
+    const payload = notificationPayload(1, true, '-');
+    const { frames, decoder } = decodeChunks([254, 255, 0, 3, 4].map(seq => telemetryFrame(TELEMETRY_FRAME_NOTIFICATION, seq, payload)));
+
+    assert.equal(frames.length, 5);
+    assert.equal(decoder.stats.missedFrames, 2);
+});
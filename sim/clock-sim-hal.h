@@ -0,0 +1,384 @@
+/*
+ * ============================================================================
+ * Host Simulation - Mock Arduino HAL
+ *
+ * Just enough of the Arduino core for arduinix-chess-clock.ino to compile as
+ * plain C++ on Linux (CLOCK_HOST_SIM):
+ *  - a virtual clock: millis()/micros() only move when the simulation
+ *    advances them (or on delay()/delayMicroseconds())
+ *  - a virtual AVR port register file (PORTB, PORTC, PORTD, PINC), so the
+ *    Uno R1-R3 port code in clock-hardware.h runs unchanged
+ *  - scripted button input, fed through PINC
+ *  - a Serial stand-in that prints each line with its virtual timestamp (and
+ *    each binary telemetry frame as hex, see clock-telemetry.h), or in raw
+ *    mode, writes the bytes to stdout untouched and reads input from stdin,
+ *    like a real serial port
+ *  - the Uno's EEPROM, and the Uno R4's RTC, for CLOCK_GAME_JOURNAL
+ * ============================================================================
+ */
+
+#ifndef _CLOCK_SIM_HAL_H
+#define _CLOCK_SIM_HAL_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef uint8_t byte;
+
+#define HIGH 0x1
+#define LOW 0x0
+
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+
+#define DEC 10
+#define HEX 16
+
+#define A0 14
+#define A1 15
+#define A2 16
+#define A3 17
+#define A4 18
+#define A5 19
+
+#define PROGMEM
+#define pgm_read_byte(addr) (*(const uint8_t*)(addr))
+#define pgm_read_word(addr) (*(const uint16_t*)(addr))
+#define pgm_read_dword(addr) simReadDword(addr)
+#define memcpy_P memcpy
+#define PSTR(s) (s)
+#define F(s) (s)
+
+// 32 bits, whatever the field's type: unsigned long is 64-bit on the host (outside
+// the sketch, see clock-sim.cpp)
+inline uint32_t simReadDword(const void* addr) {
+  uint32_t value;
+  memcpy(&value, addr, sizeof(value));
+  return value;
+}
+
+template <typename T> inline T min(T a, T b) { return a < b ? a : b; }
+template <typename T> inline T max(T a, T b) { return a > b ? a : b; }
+
+/*
+ * Virtual clock
+ */
+uint64_t simNowUS = 0;
+
+inline void simAdvanceUS(uint64_t us) {
+  simNowUS += us;
+}
+
+// 32 bits, like the real cores, so both wrap around: micros() after ~71
+// minutes, millis() after ~49.7 days (the sketch's unsigned long is narrowed to
+// match, see clock-sim.cpp)
+inline unsigned long micros() {
+  return (uint32_t)simNowUS;
+}
+
+inline unsigned long millis() {
+  return (uint32_t)(simNowUS / 1000);
+}
+
+inline void delayMicroseconds(unsigned int us) {
+  simAdvanceUS(us);
+}
+
+inline void delay(unsigned long ms) {
+  simAdvanceUS((uint64_t)ms * 1000);
+}
+
+// for benchmarks: the x86 time stamp counter where available, nanoseconds otherwise
+#if defined(__x86_64__) || defined(__i386__)
+  #include <x86intrin.h>
+
+  inline unsigned long long simCycleCounter() {
+    return __rdtsc();
+  }
+#else
+  #include <time.h>
+
+  inline unsigned long long simCycleCounter() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+  }
+#endif
+
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+/*
+ * Virtual port register file
+ */
+volatile byte PORTB = 0;
+volatile byte PORTC = 0;
+volatile byte PORTD = 0;
+
+// button inputs, as PINC bit positions; pressed buttons read LOW (pull-ups)
+byte simPressedButtonBits = 0;
+
+#define PINC ((byte)(~simPressedButtonBits))
+
+inline void pinMode(byte pin, byte mode) {}
+inline void digitalWrite(byte pin, byte val) {}
+
+// a brightly lit room, for AMBIENT_LIGHT_SENSOR_PIN
+int simAnalogReading = 1023;
+
+inline int analogRead(byte pin) {
+  return simAnalogReading;
+}
+
+/*
+ * EEPROM (the Uno's 1KB, for CLOCK_GAME_JOURNAL): each write keeps it busy
+ * for as long as the real thing would
+ */
+#define E2END 1023
+
+const uint64_t SIM_EEPROM_WRITE_US = 3400;
+
+byte simEeprom[E2END + 1];
+uint64_t simEepromBusyUntilUS = 0;
+
+struct SimEepromErased {
+  SimEepromErased() {
+    memset(simEeprom, 0xFF, sizeof(simEeprom));
+  }
+} simEepromErased;
+
+inline bool eeprom_is_ready() {
+  return simNowUS >= simEepromBusyUntilUS;
+}
+
+inline uint8_t eeprom_read_byte(const uint8_t* address) {
+  return simEeprom[(uintptr_t)address & E2END];
+}
+
+inline void eeprom_write_byte(uint8_t* address, uint8_t value) {
+  simEeprom[(uintptr_t)address & E2END] = value;
+  simEepromBusyUntilUS = simNowUS + SIM_EEPROM_WRITE_US;
+}
+
+/*
+ * RTC (the Uno R4's, for CLOCK_GAME_JOURNAL): only as much of the core's RTC
+ * library as the sketch uses. It's running at start-up (i.e. it kept time
+ * through the "power cut") only if given a time with --rtc.
+ */
+class RTCTime {
+  public:
+    RTCTime() : unixTime(0) {}
+    RTCTime(time_t t) : unixTime(t) {}
+
+    time_t getUnixTime() {
+      return unixTime;
+    }
+
+    time_t unixTime;
+};
+
+class SimRTC {
+  public:
+    bool running = false;
+    time_t setAt = 0;
+    uint64_t setAtUS = 0;
+
+    bool begin() {
+      return true;
+    }
+
+    bool isRunning() {
+      return running;
+    }
+
+    bool setTime(RTCTime& t) {
+      running = true;
+      setAt = t.unixTime;
+      setAtUS = simNowUS;
+      return true;
+    }
+
+    bool getTime(RTCTime& t) {
+      t.unixTime = running ? setAt + (time_t)((simNowUS - setAtUS) / 1000000) : 0;
+      return true;
+    }
+};
+
+SimRTC RTC;
+
+/*
+ * Serial
+ */
+class SimSerial {
+  public:
+    bool echo = true;
+    bool raw = false;
+    bool input = false;
+    bool inputClosed = false;
+    unsigned long bytesWritten = 0;
+
+    void begin(long baud) {}
+
+    size_t write(byte c) {
+      bytesWritten++;
+      uint64_t queued = txQueuedNow();
+      if (queued >= TX_BUFFER_SIZE) {
+        overruns++; // a real Uno would have waited here
+      }
+      txQueued = queued + 1;
+      txQueuedAtUS = simNowUS;
+
+      if (raw) {
+        putchar(c);
+        return 1;
+      }
+
+      // binary telemetry frames start with a sync byte that text never has
+      if (frameLength > 0 || (lineLength == 0 && c == 0xA5)) {
+        writeFrameByte(c);
+        return 1;
+      }
+
+      if (c == '\n') {
+        line[lineLength] = '\0';
+        if (echo) {
+          printf("[%10.3f] %s\n", simNowUS / 1000000.0, line);
+        }
+        lineLength = 0;
+      } else if (c != '\r' && lineLength < sizeof(line) - 1) {
+        line[lineLength++] = c;
+      }
+
+      return 1;
+    }
+
+    size_t write(const byte* buf, size_t len) {
+      for (size_t i = 0; i < len; i++) {
+        write(buf[i]);
+      }
+      return len;
+    }
+
+    size_t print(const char* s) {
+      return write((const byte*)s, strlen(s));
+    }
+
+    size_t print(char c) {
+      return write((byte)c);
+    }
+
+    size_t print(unsigned long n, int base = DEC) {
+      char buf[24];
+      snprintf(buf, sizeof(buf), base == HEX ? "%lX" : "%lu", n);
+      return print(buf);
+    }
+
+    size_t print(long n, int base = DEC) {
+      if (base == HEX) {
+        return print((unsigned long)n, base);
+      }
+      char buf[24];
+      snprintf(buf, sizeof(buf), "%ld", n);
+      return print(buf);
+    }
+
+    size_t print(int n, int base = DEC) { return print((long)n, base); }
+    size_t print(unsigned int n, int base = DEC) { return print((unsigned long)n, base); }
+    size_t print(byte n, int base = DEC) { return print((unsigned long)n, base); }
+
+    template <typename T> size_t println(T v) {
+      size_t n = print(v);
+      return n + println();
+    }
+
+    template <typename T> size_t println(T v, int base) {
+      size_t n = print(v, base);
+      return n + println();
+    }
+
+    size_t println() {
+      return print("\r\n");
+    }
+
+    // models the Uno's 63 byte transmit buffer draining at 115200 baud (writes
+    // never wait, though: past a full buffer, the excess is just counted)
+    int availableForWrite() {
+      uint64_t queued = txQueuedNow();
+      return queued >= TX_BUFFER_SIZE ? 0 : TX_BUFFER_SIZE - queued;
+    }
+
+    unsigned long txOverruns() {
+      return overruns;
+    }
+
+    void resetTxOverruns() {
+      overruns = 0;
+    }
+
+    // stdin must be non-blocking (see sim/clock-sim.cpp)
+    int available() {
+      if (input && inputPosition == inputLength && !inputClosed) {
+        ssize_t n = ::read(STDIN_FILENO, inputBuffer, sizeof(inputBuffer));
+        inputPosition = 0;
+        inputLength = n > 0 ? n : 0;
+        inputClosed = n == 0;
+      }
+      return inputLength - inputPosition;
+    }
+
+    int read() {
+      return available() > 0 ? inputBuffer[inputPosition++] : -1;
+    }
+
+    void flush() {}
+
+  private:
+    static const uint64_t TX_BUFFER_SIZE = 63;
+    static const uint64_t TX_BYTE_US = 87; // 10 bits at 115200 baud
+
+    uint64_t txQueued = 0;
+    uint64_t txQueuedAtUS = 0;
+    unsigned long overruns = 0;
+
+    uint64_t txQueuedNow() {
+      uint64_t sent = (simNowUS - txQueuedAtUS) / TX_BYTE_US;
+      return sent >= txQueued ? 0 : txQueued - sent;
+    }
+
+    char line[256];
+    size_t lineLength = 0;
+    byte frame[64];
+    size_t frameLength = 0;
+    byte inputBuffer[64];
+    size_t inputLength = 0;
+    size_t inputPosition = 0;
+
+    // sync, type, seq, len, payload, 2 CRC bytes
+    void writeFrameByte(byte c) {
+      frame[frameLength++] = c;
+
+      if (frameLength < 4 || frameLength < 4 + (size_t)frame[3] + 2) {
+        if (frameLength < sizeof(frame)) {
+          return;
+        }
+      }
+
+      if (echo) {
+        printf("[%10.3f] frame type=%u seq=%u len=%u:", simNowUS / 1000000.0, frame[1], frame[2], frame[3]);
+        for (size_t i = 0; i < frameLength; i++) {
+          printf(" %02x", frame[i]);
+        }
+        printf("\n");
+      }
+      frameLength = 0;
+    }
+};
+
+SimSerial Serial;
+
+#endif _CLOCK_SIM_HAL_H
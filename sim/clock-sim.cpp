@@ -0,0 +1,475 @@
+/*
+ * ============================================================================
+ * Host Simulation Runner
+ *
+ * Compiles arduinix-chess-clock.ino as plain C++ against the mock HAL in
+ * clock-sim-hal.h, then runs setup()/loop() on a virtual clock, pressing
+ * buttons according to a script, as fast as the host can go.
+ *
+ * Build & run (see also `npm run sim:build`):
+ *   g++ -std=gnu++11 -O2 -Wno-endif-labels -DCLOCK_HOST_SIM -o sim/clock-sim sim/clock-sim.cpp
+ *   sim/clock-sim [--loop-us N] [--until-ms N] [--trace-display] [--quiet] sim/scripts/blitz-10s.txt
+ *
+ * Script format, one button press per line (# starts a comment):
+ *   <press time ms> <L|R|U> [hold ms, default 100]
+ *
+ * To stand in for a serial-attached clock (e.g. for notification-bridge.mjs,
+ * or tools/notification-latency.mjs), add:
+ *   --realtime      pace the virtual clock to the wall clock
+ *   --raw-serial    write the clock's serial output to stdout untouched (the
+ *                   simulation's own output goes to stderr instead)
+ *   --serial-input  feed stdin to the clock as serial input, and run until it
+ *                   closes if there's no script (needs -DSERIAL_BUTTON_INPUT,
+ *                   -DCLOCK_MOVE_LOG or -DCLOCK_INSTRUMENTATION)
+ *
+ * With --check-transitions instead of a script, it prints the state machine's
+ * transition table, checks it (see checkTransitions()), and exits non-zero if
+ * anything's wrong. Run it with each combination of flags that changes the
+ * table (e.g. -DCLOCK_BRIGHTNESS_CONTROL).
+ *
+ * Built with -DCLOCK_GAME_JOURNAL, to simulate a power cut:
+ *   --eeprom <file>  load the EEPROM from the file (if it exists) before
+ *                    setup(), and save it back to the file at the end
+ *   --rtc <seconds>  have the RTC already running at start-up, at that Unix
+ *                    time, as if it had kept time on its battery
+ * e.g. run a script that ends mid-game with --eeprom, then run again with the
+ * same file and a later --rtc, and the game carries on.
+ *
+ * Add -DBUTTON_CAPTURE_INTERRUPTS to feed the button edge queue as well, with
+ * each edge timestamped at its scripted time.
+ *
+ * Built with -DCLOCK_BENCHMARK instead (`npm run bench:host`), it runs the
+ * benchmark suite from clock-benchmark.h and exits.
+ * ============================================================================
+ */
+
+#include <stdlib.h>
+#include <time.h>
+#include <fcntl.h>
+#include <vector>
+#include <algorithm>
+
+#include "clock-sim-hal.h"
+
+// The sketch keeps its timestamps in unsigned long, which is 32 bits on both
+// Arduino cores but 64 on the host. Narrow it while compiling the sketch, so
+// that its millis() & micros() arithmetic wraps around as it does on the
+// clock (micros() after ~71 minutes, millis() after ~49.7 days). Everything
+// the sketch includes is already included by the mock HAL above.
+#define long int
+#include "../arduinix-chess-clock.ino"
+#undef long
+
+typedef struct {
+  uint64_t atUS;
+  byte buttonBit;
+  bool pressed;
+} SimButtonEvent;
+
+const char* CLOCK_STATE_NAMES[] = { "IDLE", "RUNNING", "TIMEOUT", "MENU", "BRIGHTNESS" };
+const char* CLOCK_EVENT_NAMES[] = { "left", "right", "utility", "expired" };
+const char* CLOCK_ACTION_NAMES[] = { "-", "start game", "end turn", "expire turn", "step menu", "step brightness", "end game" };
+
+static_assert(sizeof(CLOCK_STATE_NAMES) / sizeof(CLOCK_STATE_NAMES[0]) == CLOCK_STATE_COUNT, "name every ClockState");
+static_assert(sizeof(CLOCK_EVENT_NAMES) / sizeof(CLOCK_EVENT_NAMES[0]) == CLOCK_EVENT_COUNT, "name every ClockEvent");
+static_assert(sizeof(CLOCK_ACTION_NAMES) / sizeof(CLOCK_ACTION_NAMES[0]) == CLOCK_ACTION_COUNT, "name every ClockAction");
+
+const unsigned long DEFAULT_LOOP_US = 50UL;
+const unsigned long DEFAULT_HOLD_MS = 100UL;
+const unsigned long DEFAULT_RUN_AFTER_LAST_EVENT_MS = 5000UL;
+
+// a tube counts as blank once it hasn't been lit for two full multiplex cycles
+const uint64_t SIM_MULTIPLEX_CYCLE_US = TUBE_COUNT * (MULTIPLEX_SINGLE_TUBE_LIT_DURATION_US + MULTIPLEX_SINGLE_TUBE_OFF_DURATION_US);
+const uint64_t SIM_TUBE_STALE_US = 2 * SIM_MULTIPLEX_CYCLE_US;
+
+FILE* simLog = stdout;
+
+byte simObservedDigits[TUBE_COUNT] = {BLANK, BLANK, BLANK, BLANK, BLANK, BLANK};
+uint64_t simObservedLitUS[TUBE_COUNT] = {0, 0, 0, 0, 0, 0};
+
+bool loadScript(const char* path, std::vector<SimButtonEvent>& events) {
+  FILE* f = fopen(path, "r");
+  if (!f) {
+    perror(path);
+    return false;
+  }
+
+  char line[128];
+  int lineNumber = 0;
+  while (fgets(line, sizeof(line), f)) {
+    lineNumber++;
+
+    char* comment = strchr(line, '#');
+    if (comment) {
+      *comment = '\0';
+    }
+
+    unsigned long atMS, holdMS = DEFAULT_HOLD_MS;
+    char button;
+    int fields = sscanf(line, "%lu %c %lu", &atMS, &button, &holdMS);
+    if (fields <= 0) {
+      continue;
+    }
+
+    byte buttonBit;
+    switch (button) {
+      case 'L': buttonBit = PIN_BUTTON_LEFT_DPM_BIT; break;
+      case 'R': buttonBit = PIN_BUTTON_RIGHT_DPM_BIT; break;
+      case 'U': buttonBit = PIN_BUTTON_UTILITY_DPM_BIT; break;
+      default:
+        fprintf(stderr, "%s:%d: expected <ms> <L|R|U> [hold ms]\n", path, lineNumber);
+        fclose(f);
+        return false;
+    }
+
+    events.push_back({ atMS * 1000ULL, buttonBit, true });
+    events.push_back({ (atMS + holdMS) * 1000ULL, buttonBit, false });
+  }
+
+  fclose(f);
+  std::stable_sort(events.begin(), events.end(), [](const SimButtonEvent& a, const SimButtonEvent& b) {
+    return a.atUS < b.atUS;
+  });
+  return true;
+}
+
+byte observedCathodeDigit(bool cathodeCtrl0) {
+  if (cathodeCtrl0) {
+    return ((PORTD & PIN_CATHODE_0_A_DPM_BIT) ? BIT_0_BCD_PIN_A : 0)
+      | ((PORTD & PIN_CATHODE_0_B_DPM_BIT) ? BIT_1_BCD_PIN_B : 0)
+      | ((PORTD & PIN_CATHODE_0_C_DPM_BIT) ? BIT_2_BCD_PIN_C : 0)
+      | ((PORTD & PIN_CATHODE_0_D_DPM_BIT) ? BIT_3_BCD_PIN_D : 0);
+  }
+
+  return ((PORTD & PIN_CATHODE_1_A_DPM_BIT) ? BIT_0_BCD_PIN_A : 0)
+    | ((PORTD & PIN_CATHODE_1_B_DPM_BIT) ? BIT_1_BCD_PIN_B : 0)
+    | ((PORTB & PIN_CATHODE_1_C_DPM_BIT) ? BIT_2_BCD_PIN_C : 0)
+    | ((PORTB & PIN_CATHODE_1_D_DPM_BIT) ? BIT_3_BCD_PIN_D : 0);
+}
+
+// decode which tube/digit the virtual ports are currently lighting, and
+// return true if the (persistence-of-vision) frame changed
+bool observeDisplay() {
+  bool changed = false;
+
+  for (byte i = 0; i < TUBE_COUNT; i++) {
+    byte digit = BLANK;
+
+    if (PORTB & pgm_read_byte(&TUBE_PORT_MASKS[i][0].portBAnode)) {
+      digit = observedCathodeDigit(TUBE_CATHODE_CTRL_0[i]);
+    }
+
+    if (digit < DIGITS_PER_TUBE) {
+      simObservedLitUS[i] = simNowUS;
+    } else if (simNowUS - simObservedLitUS[i] > SIM_TUBE_STALE_US) {
+      digit = BLANK;
+    } else {
+      continue;
+    }
+
+    if (digit != simObservedDigits[i]) {
+      simObservedDigits[i] = digit;
+      changed = true;
+    }
+  }
+
+  return changed;
+}
+
+void printDisplay() {
+  char frame[TUBE_COUNT + 1];
+  for (byte i = 0; i < TUBE_COUNT; i++) {
+    frame[i] = simObservedDigits[i] < DIGITS_PER_TUBE ? '0' + simObservedDigits[i] : '_';
+  }
+  frame[TUBE_COUNT] = '\0';
+
+  fprintf(simLog, "[%10.3f] display %.2s:%.2s:%.2s\n", simNowUS / 1000000.0, frame, frame + 2, frame + 4);
+}
+
+void usage(const char* name) {
+  fprintf(stderr, "usage: %s [--loop-us N] [--until-ms N] [--trace-display] [--quiet]\n"
+    "  [--realtime] [--raw-serial] [--serial-input] [--eeprom <file>] [--rtc <seconds>] <script>\n"
+    "       %s --check-transitions\n", name, name);
+}
+
+// a missing file is a blank (erased) EEPROM
+bool loadEeprom(const char* path) {
+  FILE* f = fopen(path, "rb");
+  if (!f) {
+    return true;
+  }
+
+  bool ok = fread(simEeprom, 1, sizeof(simEeprom), f) == sizeof(simEeprom);
+  fclose(f);
+  if (!ok) {
+    fprintf(stderr, "%s: not a %u byte EEPROM image\n", path, (unsigned)sizeof(simEeprom));
+  }
+  return ok;
+}
+
+bool saveEeprom(const char* path) {
+  FILE* f = fopen(path, "wb");
+  bool ok = f && fwrite(simEeprom, 1, sizeof(simEeprom), f) == sizeof(simEeprom);
+  if (f) {
+    fclose(f);
+  }
+  if (!ok) {
+    fprintf(stderr, "%s: couldn't save the EEPROM\n", path);
+  }
+  return ok;
+}
+
+bool simStateInBuild(byte state) {
+  #if defined(CLOCK_BRIGHTNESS_CONTROL)
+    return true;
+  #else
+    return state != CLOCK_BRIGHTNESS;
+  #endif
+}
+
+// Prints CLOCK_TRANSITIONS, then checks every entry of it: that every state in
+// this build can be reached from CLOCK_IDLE, that the utility button always
+// leads back there, and that dispatchClockEvent() lands where the table says,
+// from every state, on every event, on either player's turn (with the turn
+// only changing hands when the player to move pressed their own button).
+int checkTransitions() {
+  int problems = 0;
+
+  fprintf(simLog, "%-11s", "");
+  for (byte e = 0; e < CLOCK_EVENT_COUNT; e++) {
+    fprintf(simLog, " %-28s", CLOCK_EVENT_NAMES[e]);
+  }
+  fprintf(simLog, "\n");
+
+  for (byte s = 0; s < CLOCK_STATE_COUNT; s++) {
+    fprintf(simLog, "%-11s", CLOCK_STATE_NAMES[s]);
+    for (byte e = 0; e < CLOCK_EVENT_COUNT; e++) {
+      const ClockTransition& t = CLOCK_TRANSITIONS[s][e];
+      char entry[32];
+      snprintf(entry, sizeof(entry), "%s, %s", CLOCK_STATE_NAMES[t.next], CLOCK_ACTION_NAMES[t.action]);
+      fprintf(simLog, " %-28s", entry);
+    }
+    fprintf(simLog, "%s\n", simStateInBuild(s) ? "" : " (not in this build)");
+  }
+
+  bool reached[CLOCK_STATE_COUNT] = { true };
+  for (byte pass = 0; pass < CLOCK_STATE_COUNT; pass++) {
+    for (byte s = 0; s < CLOCK_STATE_COUNT; s++) {
+      for (byte e = 0; reached[s] && e < CLOCK_EVENT_COUNT; e++) {
+        reached[CLOCK_TRANSITIONS[s][e].next] = true;
+      }
+    }
+  }
+
+  for (byte s = 0; s < CLOCK_STATE_COUNT; s++) {
+    if (simStateInBuild(s) && !reached[s]) {
+      fprintf(simLog, "%s can't be reached from IDLE\n", CLOCK_STATE_NAMES[s]);
+      problems++;
+    }
+
+    byte state = s;
+    for (byte presses = 0; state != CLOCK_IDLE && presses < CLOCK_STATE_COUNT; presses++) {
+      state = CLOCK_TRANSITIONS[state][EVENT_UTILITY_BUTTON].next;
+    }
+    if (simStateInBuild(s) && state != CLOCK_IDLE) {
+      fprintf(simLog, "the utility button doesn't lead from %s back to IDLE\n", CLOCK_STATE_NAMES[s]);
+      problems++;
+    }
+  }
+
+  bool echo = Serial.echo;
+  Serial.echo = false;
+  setup();
+
+  for (byte s = 0; s < CLOCK_STATE_COUNT; s++) {
+    for (byte e = 0; simStateInBuild(s) && e < CLOCK_EVENT_COUNT; e++) {
+      for (byte left = 0; left < 2; left++) {
+        currentClockState = (ClockState)s;
+        leftPlayersTurn = left;
+        dispatchClockEvent((ClockEvent)e, millis(), micros());
+
+        const ClockTransition& t = CLOCK_TRANSITIONS[s][e];
+        bool turnChanges = t.action == ACTION_END_TURN && left == (e == EVENT_LEFT_BUTTON);
+        bool turnExpected = t.action == ACTION_START_GAME ? e == EVENT_LEFT_BUTTON : turnChanges ? !left : left;
+
+        if (currentClockState != t.next || leftPlayersTurn != turnExpected) {
+          fprintf(simLog, "%s on %s (%s to move) went to %s (%s to move)\n",
+            CLOCK_STATE_NAMES[s], CLOCK_EVENT_NAMES[e], left ? "left" : "right",
+            CLOCK_STATE_NAMES[currentClockState], leftPlayersTurn ? "left" : "right");
+          problems++;
+        }
+      }
+    }
+  }
+
+  Serial.echo = echo;
+  fprintf(simLog, "%d problem(s)\n", problems);
+  return problems ? 1 : 0;
+}
+
+uint64_t wallClockUS() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+// sleep off however far the virtual clock has got ahead of the wall clock
+void paceToWallClock(uint64_t wallStartUS) {
+  uint64_t wallUS = wallClockUS() - wallStartUS;
+  if (simNowUS > wallUS + 1000) {
+    usleep(simNowUS - wallUS);
+  }
+}
+
+int main(int argc, char** argv) {
+  #if defined(CLOCK_BENCHMARK)
+    // runs the benchmark suite and exits, see clock-benchmark.h
+    setup();
+  #endif
+
+  unsigned long loopUS = DEFAULT_LOOP_US;
+  unsigned long untilMS = 0;
+  bool traceDisplay = false;
+  bool realtime = false;
+  bool checkTable = false;
+  const char* scriptPath = NULL;
+  const char* eepromPath = NULL;
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--loop-us") && i + 1 < argc) {
+      loopUS = strtoul(argv[++i], NULL, 10);
+    } else if (!strcmp(argv[i], "--until-ms") && i + 1 < argc) {
+      untilMS = strtoul(argv[++i], NULL, 10);
+    } else if (!strcmp(argv[i], "--trace-display")) {
+      traceDisplay = true;
+    } else if (!strcmp(argv[i], "--quiet")) {
+      Serial.echo = false;
+    } else if (!strcmp(argv[i], "--realtime")) {
+      realtime = true;
+    } else if (!strcmp(argv[i], "--raw-serial")) {
+      Serial.raw = true;
+      simLog = stderr;
+      setvbuf(stdout, NULL, _IONBF, 0);
+    } else if (!strcmp(argv[i], "--serial-input")) {
+      #if defined(CLOCK_SERIAL_COMMANDS)
+        Serial.input = true;
+        fcntl(STDIN_FILENO, F_SETFL, fcntl(STDIN_FILENO, F_GETFL) | O_NONBLOCK);
+      #else
+        fprintf(stderr, "--serial-input needs a build with -DSERIAL_BUTTON_INPUT, -DCLOCK_MOVE_LOG or -DCLOCK_INSTRUMENTATION\n");
+        return 2;
+      #endif
+    } else if (!strcmp(argv[i], "--eeprom") && i + 1 < argc) {
+      eepromPath = argv[++i];
+    } else if (!strcmp(argv[i], "--rtc") && i + 1 < argc) {
+      RTCTime kept((time_t)strtoul(argv[++i], NULL, 10));
+      RTC.setTime(kept);
+    } else if (!strcmp(argv[i], "--check-transitions")) {
+      checkTable = true;
+    } else if (argv[i][0] != '-' && !scriptPath) {
+      scriptPath = argv[i];
+    } else {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+
+  if (checkTable) {
+    return checkTransitions();
+  }
+
+  if ((!scriptPath && !Serial.input) || loopUS == 0) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  std::vector<SimButtonEvent> events;
+  if (scriptPath && !loadScript(scriptPath, events)) {
+    return 1;
+  }
+
+  // 0: until serial input closes
+  uint64_t untilUS = untilMS
+    ? untilMS * 1000ULL
+    : scriptPath
+      ? (events.empty() ? 0 : events.back().atUS) + DEFAULT_RUN_AFTER_LAST_EVENT_MS * 1000ULL
+      : 0;
+
+  if (eepromPath && !loadEeprom(eepromPath)) {
+    return 1;
+  }
+
+  clock_t wallStart = clock();
+  uint64_t wallStartUS = wallClockUS();
+  unsigned long long loops = 0;
+  size_t nextEvent = 0;
+  ClockState lastState = currentClockState;
+  bool displayChangePending = false;
+  uint64_t displayChangedUS = 0;
+
+  setup();
+  Serial.resetTxOverruns(); // start-up messages are expected to wait
+
+  while (untilUS ? simNowUS < untilUS : !Serial.inputClosed) {
+    while (nextEvent < events.size() && events[nextEvent].atUS <= simNowUS) {
+      if (events[nextEvent].pressed) {
+        simPressedButtonBits |= events[nextEvent].buttonBit;
+      } else {
+        simPressedButtonBits &= ~events[nextEvent].buttonBit;
+      }
+
+      #if defined(BUTTON_CAPTURE_INTERRUPTS)
+        // stand in for the pin change interrupt, which would have fired at
+        // the scripted time rather than at the start of this loop
+        uint64_t loopStartUS = simNowUS;
+        simNowUS = events[nextEvent].atUS;
+        captureButtonEdge();
+        simNowUS = loopStartUS;
+      #endif
+      nextEvent++;
+    }
+
+    loop();
+    loops++;
+
+    if (currentClockState != lastState) {
+      fprintf(simLog, "[%10.3f] state %s -> %s\n", simNowUS / 1000000.0, CLOCK_STATE_NAMES[lastState], CLOCK_STATE_NAMES[currentClockState]);
+      lastState = currentClockState;
+    }
+
+    // only print once a full multiplex cycle has gone by, rather than every
+    // intermediate frame while the tubes are being scanned
+    if (observeDisplay() && !displayChangePending) {
+      displayChangePending = true;
+      displayChangedUS = simNowUS;
+    }
+
+    if (displayChangePending && simNowUS - displayChangedUS >= SIM_MULTIPLEX_CYCLE_US) {
+      displayChangePending = false;
+
+      if (traceDisplay) {
+        printDisplay();
+      }
+    }
+
+    simAdvanceUS(loopUS);
+
+    if (realtime) {
+      paceToWallClock(wallStartUS);
+    }
+  }
+
+  double wallSeconds = (double)(clock() - wallStart) / CLOCKS_PER_SEC;
+  double simSeconds = simNowUS / 1000000.0;
+  fprintf(simLog, "simulated %.3fs in %llu loops, %.3fs wall time (%.0fx real time)\n",
+    simSeconds, loops, wallSeconds, wallSeconds > 0 ? simSeconds / wallSeconds : 0.0);
+
+  if (Serial.txOverruns() > 0) {
+    fprintf(simLog, "%lu Serial writes from loop() would have waited on a full transmit buffer\n", Serial.txOverruns());
+  }
+
+  if (eepromPath && !saveEeprom(eepromPath)) {
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,55 @@
+import { readFileSync } from 'node:fs';
+
+/*
+ * Compares two saved benchmark runs (output of `npm run bench:host` or
+ * `npm run bench:avr`), matching BENCH lines by function & variant.
+ *
+ * Usage: node tools/bench-compare.mjs <before.txt> <after.txt>
+ */
+const BENCH_LINE = /BENCH,([^,]+),([^,]+),calls=(\d+),min=(\d+),avg=(\d+),max=(\d+)/;
+
+const parseRun = path => {
+    const results = new Map();
+
+    readFileSync(path, 'utf8').split('\n').forEach(line => {
+        const match = line.match(BENCH_LINE);
+        if (match) {
+            const [, name, variant, calls, min, avg, max] = match;
+            results.set(`${name} ${variant}`, { min: Number(min), avg: Number(avg), max: Number(max) });
+        }
+    });
+
+    return results;
+};
+
+const change = (before, after) => {
+    if (before === 0) {
+        return after === 0 ? '0.0%' : 'n/a';
+    }
+    const pct = (after - before) / before * 100;
+    return `${pct > 0 ? '+' : ''}${pct.toFixed(1)}%`;
+};
+
+const [beforePath, afterPath] = process.argv.slice(2);
+if (!beforePath || !afterPath) {
+    console.error('Usage: node tools/bench-compare.mjs <before.txt> <after.txt>');
+    process.exit(2);
+}
+
+const before = parseRun(beforePath);
+const after = parseRun(afterPath);
+
+console.table([...new Set([...before.keys(), ...after.keys()])].map(key => {
+    const b = before.get(key);
+    const a = after.get(key);
+
+    return {
+        benchmark: key,
+        'avg before': b ? b.avg : '-',
+        'avg after': a ? a.avg : '-',
+        'avg change': a && b ? change(b.avg, a.avg) : '-',
+        'min before': b ? b.min : '-',
+        'min after': a ? a.min : '-',
+        'min change': a && b ? change(b.min, a.min) : '-',
+    };
+}));
@@ -0,0 +1,229 @@
+import { spawn, execFileSync } from 'node:child_process';
+import { existsSync, readdirSync, readFileSync } from 'node:fs';
+import { homedir } from 'node:os';
+import { basename, join } from 'node:path';
+
+/*
+ * RAM & flash budget report for the Uno R1-R3 build.
+ *
+ * Reads the ELF from an arduino-cli build of the sketch (`npm run budget:avr`
+ * makes one, with CLOCK_STACK_REPORT), and reports:
+ *  - flash use (code, PROGMEM data & the initial values of .data), and
+ *    static RAM use (.data, .bss & .noinit), from avr-size
+ *  - both broken down by source file, from avr-nm's symbol sizes & line info.
+ *    The sketch is a single translation unit, so each header is a "module",
+ *    but inline functions count towards whatever they were inlined into
+ *    (mostly setup() & loop(), in arduinix-chess-clock.ino).
+ *  - the stack's high-water mark, from the last CCSTACK line (see
+ *    clock-stack.h) in a saved serial log from a real clock (--stack-log), or
+ *    from running the ELF under simavr for a while (--simavr), where the clock
+ *    sits idle, so it only shows setup() & the idle loop
+ *
+ * Exits with status 1 if anything is over budget, so it can gate changes.
+ *
+ * avr-size & avr-nm are looked for on the PATH, then in arduino-cli's
+ * toolchain (~/.arduino15), or in --toolchain <dir>.
+ *
+ * Usage: node tools/memory-budget.mjs [--max-flash N] [--max-static-ram N]
+ *          [--min-stack-headroom N] [--stack-log <file> | --simavr <seconds>]
+ *          [--toolchain <dir>] <elf>
+ */
+const UNO_FLASH_BYTES = 32256; // 32KB, less the Optiboot bootloader
+const UNO_RAM_BYTES = 2048;
+
+const DEFAULT_MAX_FLASH_BYTES = UNO_FLASH_BYTES;
+const DEFAULT_MAX_STATIC_RAM_BYTES = 1536; // leaving 512 bytes for the stack
+const DEFAULT_MIN_STACK_HEADROOM_BYTES = 128;
+
+// AVR ELF address spaces
+const RAM_ADDRESS = 0x800000;
+const EEPROM_ADDRESS = 0x810000;
+
+const SKETCH_FILE = /(^|\/)(arduinix-chess-clock\.ino|clock-[\w-]+\.h)$/;
+const STACK_LINE = /CCSTACK,(\d+),(\d+)/g;
+
+const parseArgs = argv => {
+    const options = {
+        maxFlash: DEFAULT_MAX_FLASH_BYTES,
+        maxStaticRAM: DEFAULT_MAX_STATIC_RAM_BYTES,
+        minStackHeadroom: DEFAULT_MIN_STACK_HEADROOM_BYTES,
+        stackLog: null,
+        simavrSeconds: null,
+        toolchain: null,
+        elf: null,
+    };
+
+    for (let i = 0; i < argv.length; i++) {
+        switch (argv[i]) {
+            case '--max-flash': options.maxFlash = Number(argv[++i]); break;
+            case '--max-static-ram': options.maxStaticRAM = Number(argv[++i]); break;
+            case '--min-stack-headroom': options.minStackHeadroom = Number(argv[++i]); break;
+            case '--stack-log': options.stackLog = argv[++i]; break;
+            case '--simavr': options.simavrSeconds = Number(argv[++i]); break;
+            case '--toolchain': options.toolchain = argv[++i]; break;
+            default:
+                if (argv[i].startsWith('--') || options.elf) {
+                    return null;
+                }
+                options.elf = argv[i];
+        }
+    }
+
+    return options.elf && !(options.stackLog && options.simavrSeconds) ? options : null;
+};
+
+// on the PATH, or the newest avr-gcc that arduino-cli has installed
+const findTool = (name, toolchain) => {
+    if (toolchain) {
+        return join(toolchain, name);
+    }
+
+    try {
+        execFileSync(name, ['--version'], { stdio: 'ignore' });
+        return name;
+    } catch {
+        const tools = join(homedir(), '.arduino15', 'packages', 'arduino', 'tools', 'avr-gcc');
+        const versions = existsSync(tools) ? readdirSync(tools).sort() : [];
+        const path = versions.length ? join(tools, versions[versions.length - 1], 'bin', name) : null;
+
+        if (!path || !existsSync(path)) {
+            throw new Error(`${name} not found: put it on the PATH, or pass --toolchain <dir>`);
+        }
+        return path;
+    }
+};
+
+const run = (tool, args) => execFileSync(tool, args, { encoding: 'utf8', maxBuffer: 16 * 1024 * 1024 });
+
+// section name -> size
+const readSections = (avrSize, elf) => {
+    const sections = new Map();
+
+    run(avrSize, ['-A', elf]).split('\n').forEach(line => {
+        const match = line.match(/^(\.\S+)\s+(\d+)\s+(\d+)/);
+        if (match) {
+            sections.set(match[1], Number(match[2]));
+        }
+    });
+
+    return sections;
+};
+
+// module -> { flash, ram }
+const readModules = (avrNm, elf) => {
+    const modules = new Map();
+
+    run(avrNm, ['--print-size', '--size-sort', '--line-numbers', '-C', elf]).split('\n').forEach(line => {
+        const match = line.match(/^([0-9a-f]+) ([0-9a-f]+) (\w) ([^\t]+)(?:\t(.+):\d+)?$/i);
+        if (!match) {
+            return;
+        }
+
+        const [, addressHex, sizeHex, type, , file] = match;
+        const address = parseInt(addressHex, 16);
+        const size = parseInt(sizeHex, 16);
+        if (address >= EEPROM_ADDRESS) {
+            return;
+        }
+
+        const name = !file ? '(no line info)' : SKETCH_FILE.test(file) ? basename(file) : `(core) ${basename(file)}`;
+        const module = modules.get(name) ?? { flash: 0, ram: 0 };
+
+        if (address < RAM_ADDRESS) {
+            module.flash += size;
+        } else {
+            module.ram += size;
+            // initialized data is copied into RAM from flash at start-up
+            if (type === 'D' || type === 'd') {
+                module.flash += size;
+            }
+        }
+
+        modules.set(name, module);
+    });
+
+    return modules;
+};
+
+// the last report is the deepest, since the high-water mark only ever rises
+const lastStackReport = output => {
+    const reports = [...output.matchAll(STACK_LINE)];
+    if (!reports.length) {
+        return null;
+    }
+
+    const [, used, headroom] = reports[reports.length - 1];
+    return { used: Number(used), headroom: Number(headroom) };
+};
+
+const runSimavr = (elf, seconds) => new Promise(resolve => {
+    const simavr = spawn('simavr', ['-m', 'atmega328p', '-f', '16000000', elf]);
+    let output = '';
+
+    simavr.stdout.on('data', chunk => { output += chunk; });
+    simavr.stderr.on('data', chunk => { output += chunk; });
+    simavr.on('error', error => {
+        console.error(`simavr: ${error.message}`);
+        resolve('');
+    });
+    simavr.on('close', () => resolve(output));
+
+    setTimeout(() => simavr.kill(), seconds * 1000);
+});
+
+/*
+ * Main Run
+ */
+const options = parseArgs(process.argv.slice(2));
+if (!options) {
+    console.error('Usage: node tools/memory-budget.mjs [--max-flash N] [--max-static-ram N]\n'
+        + '         [--min-stack-headroom N] [--stack-log <file> | --simavr <seconds>]\n'
+        + '         [--toolchain <dir>] <elf>');
+    process.exit(2);
+}
+
+const sections = readSections(findTool('avr-size', options.toolchain), options.elf);
+const modules = readModules(findTool('avr-nm', options.toolchain), options.elf);
+
+const section = name => sections.get(name) ?? 0;
+const flash = section('.text') + section('.data');
+const staticRAM = section('.data') + section('.bss') + section('.noinit');
+
+console.table([...modules.entries()]
+    .sort(([, a], [, b]) => (b.flash + b.ram) - (a.flash + a.ram))
+    .map(([module, { flash, ram }]) => ({ module, 'flash bytes': flash, 'static RAM bytes': ram })));
+
+let stack = null;
+if (options.stackLog) {
+    stack = lastStackReport(readFileSync(options.stackLog, 'utf8'));
+} else if (options.simavrSeconds) {
+    stack = lastStackReport(await runSimavr(options.elf, options.simavrSeconds));
+}
+
+const budgets = [
+    { what: 'flash', bytes: flash, budget: `<= ${options.maxFlash}`, ok: flash <= options.maxFlash },
+    { what: 'static RAM', bytes: staticRAM, budget: `<= ${options.maxStaticRAM}`, ok: staticRAM <= options.maxStaticRAM },
+];
+
+if (stack) {
+    budgets.push({ what: 'stack high-water', bytes: stack.used, budget: '-', ok: true });
+    budgets.push({
+        what: 'stack headroom',
+        bytes: stack.headroom,
+        budget: `>= ${options.minStackHeadroom}`,
+        ok: stack.headroom >= options.minStackHeadroom,
+    });
+} else if (options.stackLog || options.simavrSeconds) {
+    // asked for, but the build didn't have CLOCK_STACK_REPORT, or never got as far
+    budgets.push({ what: 'stack headroom', bytes: '-', budget: `>= ${options.minStackHeadroom}`, ok: false });
+}
+
+console.table(budgets.map(({ what, bytes, budget, ok }) => ({
+    what,
+    bytes,
+    'of Uno': typeof bytes === 'number' ? `${(bytes / (what === 'flash' ? UNO_FLASH_BYTES : UNO_RAM_BYTES) * 100).toFixed(1)}%` : '-',
+    budget,
+    result: ok ? 'ok' : 'FAIL',
+})));
+
+process.exit(budgets.every(b => b.ok) ? 0 : 1);
@@ -0,0 +1,254 @@
+import { spawn } from 'node:child_process';
+import { readFileSync } from 'node:fs';
+import { performance } from 'node:perf_hooks';
+import { setTimeout as sleep } from 'node:timers/promises';
+import { ClockStreamDecoder, decodeNotificationLine } from '../notification-protocol.mjs';
+import { startNtfySink } from './ntfy-sink.mjs';
+
+/*
+ * Press-to-notification latency harness.
+ *
+ * Plays a sim/scripts/*.txt button script into a clock built with
+ * SERIAL_BUTTON_INPUT (see clock-config.h), in real time, sending each press
+ * over Serial, and times every notification from the press that caused it to
+ * the moment its POST arrives at a local ntfy stand-in (tools/ntfy-sink.mjs).
+ * Timeouts aren't caused by a press, so they're timed from when the clock
+ * reported the event instead.
+ *
+ * The clock is either the host simulation (--sim, the default), or real
+ * hardware on a serial port (--serial). By default, the clock's serial output
+ * is piped through notification-bridge.mjs, which POSTs to the sink: the Uno
+ * path. With --direct, the clock POSTs to the sink itself: the R4 path, which
+ * needs SECRET_NTFY_SERVER & SECRET_NTFY_SERVER_PORT in clock-secrets.h set to
+ * this machine's address & --sink-port.
+ *
+ * Exits with status 1 if any notification was dropped, or if any type's p99
+ * latency is over --max-p99-ms, so it can gate changes to the notification
+ * pipeline.
+ *
+ * Usage: node tools/notification-latency.mjs [--sim <binary> | --serial <path> [--baud N]]
+ *          [--direct] [--sink-port N] [--grace-ms N] [--max-p99-ms N] <script>
+ */
+const NOTIFICATION_TYPES = ['NEW_GAME', 'PLAYER_TURN', 'TIMEOUT'];
+const NEW_GAME = 0;
+const PLAYER_TURN = 1;
+const TIMEOUT = 2;
+
+// new games & timeouts go to both players
+const REQUESTS_PER_NOTIFICATION = [2, 1, 2];
+
+const SERIAL_BUTTON_HOLD_MS = 100;
+const SETUP_COMPLETE = 'Setup complete!';
+
+const parseArgs = argv => {
+    const options = {
+        sim: 'sim/clock-sim-input',
+        serial: null,
+        baud: 115200,
+        direct: false,
+        sinkPort: null,
+        graceMS: 3000,
+        maxP99MS: null,
+        script: null,
+    };
+
+    for (let i = 0; i < argv.length; i++) {
+        switch (argv[i]) {
+            case '--sim': options.sim = argv[++i]; break;
+            case '--serial': options.serial = argv[++i]; break;
+            case '--baud': options.baud = Number(argv[++i]); break;
+            case '--direct': options.direct = true; break;
+            case '--sink-port': options.sinkPort = Number(argv[++i]); break;
+            case '--grace-ms': options.graceMS = Number(argv[++i]); break;
+            case '--max-p99-ms': options.maxP99MS = Number(argv[++i]); break;
+            default:
+                if (argv[i].startsWith('--') || options.script) {
+                    return null;
+                }
+                options.script = argv[i];
+        }
+    }
+
+    return options.script ? options : null;
+};
+
+// same format as the host simulation's scripts: <press time ms> <L|R|U> [hold ms]
+const loadScript = path => readFileSync(path, 'utf8').split('\n').flatMap((line, i) => {
+    const fields = line.replace(/#.*/, '').trim().split(/\s+/).filter(Boolean);
+    if (!fields.length) {
+        return [];
+    }
+
+    const [atMS, button, holdMS] = fields;
+    if (!/^\d+$/.test(atMS) || !['L', 'R', 'U'].includes(button)) {
+        throw new Error(`${path}:${i + 1}: expected <ms> <L|R|U> [hold ms]`);
+    }
+    if (holdMS && Number(holdMS) !== SERIAL_BUTTON_HOLD_MS) {
+        console.warn(`${path}:${i + 1}: serial presses are always held for ${SERIAL_BUTTON_HOLD_MS}ms`);
+    }
+
+    return [{ atMS: Number(atMS), button }];
+}).sort((a, b) => a.atMS - b.atMS);
+
+const classifyMessage = body => {
+    if (body.startsWith('New Game')) {
+        return NEW_GAME;
+    } else if (body.startsWith('Your Move')) {
+        return PLAYER_TURN;
+    } else if (body.startsWith('Game Over')) {
+        return TIMEOUT;
+    }
+    return null;
+};
+
+// nearest-rank
+const percentile = (sorted, p) => sorted.length
+    ? sorted[Math.min(sorted.length - 1, Math.ceil(p / 100 * sorted.length) - 1)]
+    : null;
+
+const openSimClock = path => {
+    const sim = spawn(path, ['--realtime', '--raw-serial', '--serial-input'], { stdio: ['pipe', 'pipe', 'ignore'] });
+
+    return {
+        onData: handler => sim.stdout.on('data', handler),
+        write: bytes => sim.stdin.write(bytes),
+        close: () => sim.stdin.end(),
+    };
+};
+
+const openSerialClock = async (path, baudRate) => {
+    const { SerialPort } = await import('serialport');
+    const port = new SerialPort({ path, baudRate });
+
+    return {
+        onData: handler => port.on('data', handler),
+        write: bytes => port.write(bytes),
+        close: () => port.close(),
+    };
+};
+
+const startBridge = sinkPort => spawn(process.execPath, ['notification-bridge.mjs'], {
+    env: {
+        ...process.env,
+        ARDUINO_SERIAL_PORT: '-',
+        NTFY_SERVER_URL: `http://127.0.0.1:${sinkPort}`,
+        TOPIC_LEFT: 'left',
+        TOPIC_RIGHT: 'right',
+        DRY_RUN: 'false',
+        DEBUG: 'false',
+    },
+    stdio: ['pipe', 'ignore', 'inherit'],
+});
+
+/*
+ * Main Run
+ */
+const options = parseArgs(process.argv.slice(2));
+if (!options) {
+    console.error('Usage: node tools/notification-latency.mjs [--sim <binary> | --serial <path> [--baud N]]\n'
+        + '         [--direct] [--sink-port N] [--grace-ms N] [--max-p99-ms N] <script>');
+    process.exit(2);
+}
+
+const presses = loadScript(options.script);
+const sink = await startNtfySink(options.direct
+    ? { port: options.sinkPort ?? 8080, host: '0.0.0.0' }
+    : { port: options.sinkPort ?? 0 });
+const bridge = options.direct ? null : startBridge(sink.port);
+const clock = options.serial ? await openSerialClock(options.serial, options.baud) : openSimClock(options.sim);
+
+// one entry per request that should arrive, timed from its cause
+const expected = [];
+let lastPressAt = null;
+let setupComplete = false;
+
+const decoder = new ClockStreamDecoder({
+    onLine: line => {
+        if (line === SETUP_COMPLETE) {
+            setupComplete = true;
+        }
+
+        const notification = decodeNotificationLine(line);
+        if (notification) {
+            expectRequests(notification);
+        }
+    },
+    onFrame: frame => {
+        if (frame.kind === 'notification') {
+            expectRequests(frame);
+        }
+    },
+});
+
+const expectRequests = ({ notificationType }) => {
+    const causedAt = notificationType === TIMEOUT || lastPressAt === null ? performance.now() : lastPressAt;
+
+    for (let i = 0; i < REQUESTS_PER_NOTIFICATION[notificationType]; i++) {
+        expected.push({ type: notificationType, causedAt, arrival: null });
+    }
+};
+
+clock.onData(chunk => {
+    bridge?.stdin.write(chunk);
+    decoder.push(chunk);
+});
+
+while (!setupComplete) {
+    await sleep(10);
+}
+
+const startedAt = performance.now();
+for (const { atMS, button } of presses) {
+    const waitMS = startedAt + atMS - performance.now();
+    if (waitMS > 0) {
+        await sleep(waitMS);
+    }
+
+    lastPressAt = performance.now();
+    clock.write(button);
+}
+
+await sleep(options.graceMS);
+clock.close();
+bridge?.stdin.end();
+await sink.close();
+
+// match each arrival to the oldest outstanding request of its type
+let unexpected = 0;
+for (const message of sink.messages) {
+    const type = classifyMessage(message.body);
+    const match = expected.find(e => e.type === type && !e.arrival && e.causedAt <= message.arrivedAt);
+
+    if (match) {
+        match.arrival = message;
+    } else {
+        unexpected++;
+    }
+}
+
+let failed = false;
+console.table(NOTIFICATION_TYPES.map((name, type) => {
+    const requests = expected.filter(e => e.type === type);
+    const latencies = requests.filter(e => e.arrival).map(e => e.arrival.arrivedAt - e.causedAt).sort((a, b) => a - b);
+    const p99 = percentile(latencies, 99);
+
+    if (latencies.length < requests.length || (options.maxP99MS !== null && p99 > options.maxP99MS)) {
+        failed = true;
+    }
+
+    return {
+        type: name,
+        expected: requests.length,
+        received: latencies.length,
+        dropped: requests.length - latencies.length,
+        'p50 ms': latencies.length ? +percentile(latencies, 50).toFixed(1) : '-',
+        'p99 ms': latencies.length ? +p99.toFixed(1) : '-',
+        'max ms': latencies.length ? +latencies[latencies.length - 1].toFixed(1) : '-',
+    };
+}));
+
+if (unexpected) {
+    console.log(`${unexpected} unexpected message(s) arrived`);
+}
+
+process.exit(failed ? 1 : 0);
@@ -0,0 +1,69 @@
+import http from 'node:http';
+import { performance } from 'node:perf_hooks';
+
+/*
+ * A local stand-in for ntfy's publish endpoint (`POST /<topic>`, with the
+ * message as the plain text body), which records when each message arrived,
+ * so the notification pipeline can be exercised & timed with no internet
+ * access. Used by tools/notification-latency.mjs, or run it on its own and
+ * point the bridge (NTFY_SERVER_URL) or the R4 (SECRET_NTFY_SERVER &
+ * SECRET_NTFY_SERVER_PORT) at it.
+ *
+ * Usage: node tools/ntfy-sink.mjs [port, default 8080] [host, default 0.0.0.0]
+ */
+export const startNtfySink = ({ port = 0, host = '127.0.0.1', onMessage = () => {} } = {}) => new Promise((resolve, reject) => {
+    const messages = [];
+
+    const server = http.createServer((req, res) => {
+        const chunks = [];
+
+        req.on('data', chunk => chunks.push(chunk));
+        req.on('end', () => {
+            const topic = decodeURIComponent(req.url.slice(1));
+
+            if (req.method !== 'POST' || !topic || topic.includes('/')) {
+                res.writeHead(404, { 'Content-Type': 'application/json' });
+                res.end(JSON.stringify({ code: 40401, http: 404, error: 'page not found' }));
+                return;
+            }
+
+            // timestamped once the whole body is in, as ntfy would
+            const message = {
+                arrivedAt: performance.now(),
+                topic,
+                body: Buffer.concat(chunks).toString('utf8'),
+            };
+            messages.push(message);
+            onMessage(message);
+
+            res.writeHead(200, { 'Content-Type': 'application/json' });
+            res.end(JSON.stringify({
+                id: messages.length.toString(36),
+                time: Math.floor(Date.now() / 1000),
+                event: 'message',
+                topic,
+                message: message.body,
+            }) + '\n');
+        });
+    });
+
+    server.on('error', reject);
+    server.listen(port, host, () => resolve({
+        server,
+        port: server.address().port,
+        messages,
+        close: () => new Promise(done => server.close(done)),
+    }));
+});
+
+if (import.meta.url === `file://${process.argv[1]}`) {
+    const port = Number(process.argv[2] ?? 8080);
+    const host = process.argv[3] ?? '0.0.0.0';
+
+    const sink = await startNtfySink({
+        port,
+        host,
+        onMessage: ({ topic, body }) => console.log(`${new Date().toISOString()} [${topic}] ${body}`),
+    });
+    console.log(`ntfy sink listening on ${host}:${sink.port}`);
+}
@@ -0,0 +1,82 @@
+import { execFileSync } from 'node:child_process';
+import { existsSync, readdirSync, readFileSync, writeFileSync } from 'node:fs';
+import { basename, join } from 'node:path';
+
+/*
+ * Display trace regression check for the host simulation.
+ *
+ * Runs each sim/scripts/*.txt button script through a default build of the
+ * host simulation with --trace-display, and compares the output (states,
+ * every frame shown on the tubes, and the clock's serial output, all with
+ * their virtual timestamps) against the expected trace checked in under
+ * sim/traces/. The closing "simulated ... wall time" line is left out, since
+ * the wall time varies from run to run.
+ *
+ * Exits with status 1 if any trace differs (printing the first few lines that
+ * do), so a change that's meant to leave the clock's behaviour alone can be
+ * checked against it. When a change is meant to alter the traces, --update
+ * rewrites them, and the diff to sim/traces/ is then part of the change.
+ *
+ * Usage: node tools/sim-trace-check.mjs [--sim <binary>] [--update]
+ */
+const SCRIPTS_DIR = 'sim/scripts';
+const TRACES_DIR = 'sim/traces';
+const MAX_DIFF_LINES = 10;
+
+const args = process.argv.slice(2);
+const update = args.includes('--update');
+const simIndex = args.indexOf('--sim');
+const sim = simIndex >= 0 ? args[simIndex + 1] : 'sim/clock-sim';
+
+if (!existsSync(sim)) {
+    console.error(`No simulation binary at ${sim} (npm run sim:build)`);
+    process.exit(2);
+}
+
+const traceScript = script => execFileSync(sim, ['--trace-display', script], { encoding: 'utf8', maxBuffer: 64 * 1024 * 1024 })
+    .split('\n')
+    .filter(line => !line.startsWith('simulated '))
+    .join('\n');
+
+const diffLines = (expected, actual) => {
+    const expectedLines = expected.split('\n');
+    const actualLines = actual.split('\n');
+    const diffs = [];
+
+    for (let i = 0; i < Math.max(expectedLines.length, actualLines.length) && diffs.length < MAX_DIFF_LINES; i++) {
+        if (expectedLines[i] !== actualLines[i]) {
+            diffs.push(`  line ${i + 1}:\n    - ${expectedLines[i] ?? '(end of trace)'}\n    + ${actualLines[i] ?? '(end of trace)'}`);
+        }
+    }
+
+    return diffs;
+};
+
+let failed = false;
+
+readdirSync(SCRIPTS_DIR).filter(name => name.endsWith('.txt')).sort().forEach(name => {
+    const tracePath = join(TRACES_DIR, `${basename(name, '.txt')}.trace`);
+    const actual = traceScript(join(SCRIPTS_DIR, name));
+
+    if (update) {
+        writeFileSync(tracePath, actual);
+        console.log(`updated ${tracePath}`);
+        return;
+    }
+
+    if (!existsSync(tracePath)) {
+        console.log(`MISSING ${tracePath} (run with --update to create it)`);
+        failed = true;
+        return;
+    }
+
+    const diffs = diffLines(readFileSync(tracePath, 'utf8'), actual);
+    if (diffs.length === 0) {
+        console.log(`ok      ${name}`);
+    } else {
+        console.log(`CHANGED ${name}\n${diffs.join('\n')}`);
+        failed = true;
+    }
+});
+
+process.exit(failed ? 1 : 0);